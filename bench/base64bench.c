@@ -0,0 +1,136 @@
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "base64.h"
+
+// Compares base64_encode with every wrapped kernel the CPU supports and checks
+// each wrapped output against the unwrapped one with the CRLFs removed.
+//
+//   make bench && ./base64bench [MB] [rounds]
+
+static double Now(void)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+static bool SameAsUnwrapped(const char *pWrapped, size_t wrappedLen, const char *pPlain, size_t plainLen)
+{
+    size_t plainIndex = 0;
+
+    for (size_t index=0; index<wrappedLen; index++)
+    {
+        if (pWrapped[index] == '\r' || pWrapped[index] == '\n')
+        {
+            continue;
+        }
+
+        if (plainIndex >= plainLen || pWrapped[index] != pPlain[plainIndex++])
+        {
+            return false;
+        }
+    }
+
+    return plainIndex == plainLen;
+}
+
+static void Report(const char *pName, size_t dataLen, int rounds, double seconds)
+{
+    fprintf(stderr, "%-12s: %8.1f MB/s\n", pName, (double) dataLen * rounds / seconds / (1 << 20));
+}
+
+int main(int argc, char **pArgv)
+{
+    size_t dataLen = (size_t) (argc > 1 ? atoi(pArgv[1]) : 16) << 20;
+    int    rounds  = argc > 2 ? atoi(pArgv[2]) : 10;
+
+    unsigned char *pData    = malloc(dataLen);
+    char          *pWrapped = malloc(Base64WrappedLength(dataLen) + 1);
+
+    if (!pData || !pWrapped)
+    {
+        fprintf(stderr, "Failure allocating %zu bytes\n", dataLen);
+        return EXIT_FAILURE;
+    }
+
+    srand(1);
+
+    for (size_t index=0; index<dataLen; index++)
+    {
+        pData[index] = rand();
+    }
+
+    size_t plainLen = 0;
+    char   *pPlain  = NULL;
+
+    double start = Now();
+
+    for (int round=0; round<rounds; round++)
+    {
+        free(pPlain);
+
+        pPlain = base64_encode(pData, dataLen, &plainLen);
+    }
+
+    Report("base64_encode", dataLen, rounds, Now() - start);
+
+    int failures = 0;
+
+    for (Base64Kernel kernel=BASE64_SCALAR; kernel<=BASE64_AVX2; kernel++)
+    {
+        if (!Base64SetKernel(kernel))
+        {
+            fprintf(stderr, "%-12s: not supported\n", Base64KernelName(kernel));
+            continue;
+        }
+
+        size_t wrappedLen = 0;
+
+        start = Now();
+
+        for (int round=0; round<rounds; round++)
+        {
+            wrappedLen = Base64EncodeWrappedTo(pData, dataLen, pWrapped);
+        }
+
+        Report(Base64KernelName(kernel), dataLen, rounds, Now() - start);
+
+        // Every tail length through the kernel and scalar paths
+
+        for (size_t tailLen=0; tailLen<=3 * BASE64_LINE_BYTES; tailLen++)
+        {
+            size_t checkLen;
+            char   *pCheck = base64_encode(pData, tailLen, &checkLen);
+
+            wrappedLen = Base64EncodeWrappedTo(pData, tailLen, pWrapped);
+
+            if (!SameAsUnwrapped(pWrapped, wrappedLen, pCheck, checkLen) || wrappedLen != Base64WrappedLength(tailLen))
+            {
+                fprintf(stderr, "%-12s: mismatch at %zu bytes\n", Base64KernelName(kernel), tailLen);
+                failures++;
+            }
+
+            free(pCheck);
+        }
+
+        wrappedLen = Base64EncodeWrappedTo(pData, dataLen, pWrapped);
+
+        if (!SameAsUnwrapped(pWrapped, wrappedLen, pPlain, plainLen))
+        {
+            fprintf(stderr, "%-12s: mismatch on the full buffer\n", Base64KernelName(kernel));
+            failures++;
+        }
+    }
+
+    free(pPlain);
+    free(pWrapped);
+    free(pData);
+
+    return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,226 @@
+#!/usr/bin/env python3
+#
+# End to end benchmark: serves synthetic Calls.json pages and Events.json
+# bodies from a local stand-in for the Twilio API, runs cantv against it and
+# reports calls/sec, wall time and peak RSS.
+#
+#   make bench-e2e BENCH_ARGS="--calls 5000 --latency 0.05 -- -c 64"
+#
+# Arguments after -- are passed to cantv.
+
+import argparse
+import http.server
+import json
+import os
+import random
+import re
+import resource
+import socketserver
+import subprocess
+import sys
+import tempfile
+import threading
+import time
+
+ACCOUNT = "ACbench00000000000000000000000000"
+APIKEY  = "bench"
+
+
+def make_call(index):
+    day = index % 28 + 1
+    return {
+        "sid":            "CA%032d" % index,
+        "from_formatted": "(555) 000-%04d" % (index % 10000),
+        "to_formatted":   "(555) 111-0000",
+        "start_time":     "Mon, %02d Mar 2021 12:%02d:00 +0000" % (day, index % 60),
+        "end_time":       "Mon, %02d Mar 2021 12:59:00 +0000" % day,
+        "duration":       str(index % 300),
+    }
+
+
+def make_events(index):
+    # One call in seven never hears its number and is reported as Invalid
+
+    if index % 7 == 0:
+        return {"events": [{"request": {"x": 1}, "response": {"response_body": "<Say>Goodbye</Say>"}}]}
+
+    return {"events": [
+        {"request": {"padding": "x" * 200}, "response": {"response_body": "<Say>Hello</Say>"}},
+        {"request": {}, "response": {"response_body": "<Say>Your number %03d will appear soon</Say>" % (index % 13)}},
+    ]}
+
+
+class Stats:
+    def __init__(self):
+        self.lock   = threading.Lock()
+        self.pages  = 0
+        self.events = 0
+        self.errors = 0
+        self.throttled = 0
+
+    def add(self, name):
+        with self.lock:
+            setattr(self, name, getattr(self, name) + 1)
+
+
+def make_handler(options, stats):
+    class Handler(http.server.BaseHTTPRequestHandler):
+        protocol_version = "HTTP/1.1"
+        disable_nagle_algorithm = True
+
+        def log_message(self, *args):
+            pass
+
+        def reply(self, status, body, headers=()):
+            data = json.dumps(body).encode()
+
+            self.send_response(status)
+            self.send_header("Content-Type", "application/json")
+            self.send_header("Content-Length", str(len(data)))
+
+            for name, value in headers:
+                self.send_header(name, value)
+
+            self.end_headers()
+            self.wfile.write(data)
+
+        def do_GET(self):
+            time.sleep(options.latency)
+
+            path = self.path
+
+            match = re.search(r"/Calls/CA(\d+)/Events\.json", path)
+
+            if match:
+                roll = random.random()
+
+                if roll < options.throttle_rate:
+                    stats.add("throttled")
+                    return self.reply(429, {"message": "Too Many Requests"}, [("Retry-After", "1")])
+
+                if roll < options.throttle_rate + options.error_rate:
+                    stats.add("errors")
+                    return self.reply(500, {"message": "Internal Server Error"})
+
+                stats.add("events")
+                return self.reply(200, make_events(int(match.group(1))))
+
+            if "/Calls.json" in path:
+                stats.add("pages")
+
+                # Honour the day window so sharded listings split the calls
+
+                low  = re.search(r"StartTime>=\d{4}-\d\d-(\d\d)", path)
+                high = re.search(r"(?:Start|End)Time<=\d{4}-\d\d-(\d\d)", path)
+                low  = int(low.group(1))  if low  else 1
+                high = int(high.group(1)) if high else 31
+
+                page = re.search(r"Page=(\d+)", path)
+                page = int(page.group(1)) if page else 0
+
+                selected = [index for index in range(options.calls) if low <= index % 28 + 1 <= high]
+                calls    = [make_call(index) for index in selected[page * options.page_size:(page + 1) * options.page_size]]
+
+                next_uri = None
+
+                if (page + 1) * options.page_size < len(selected):
+                    next_uri = re.sub(r"&Page=\d+", "", path) + "&Page=%d" % (page + 1)
+
+                return self.reply(200, {"calls": calls, "next_page_uri": next_uri, "page": page})
+
+            self.reply(404, {"message": "Not Found"})
+
+    return Handler
+
+
+class Server(socketserver.ThreadingMixIn, http.server.HTTPServer):
+    daemon_threads     = True
+    request_queue_size = 1024
+
+
+# None when the run left no report.csv or one without a Total row
+
+def counted_calls(report_path):
+    try:
+        with open(report_path) as report:
+            for line in report:
+                if line.startswith("Total"):
+                    return int(line.split(",")[1])
+    except (OSError, ValueError, IndexError):
+        pass
+
+    return None
+
+
+def main():
+    parser = argparse.ArgumentParser(description="cantv end to end benchmark")
+    parser.add_argument("--binary",        default="./cantv")
+    parser.add_argument("--calls",         type=int,   default=2000)
+    parser.add_argument("--page-size",     type=int,   default=50)
+    parser.add_argument("--latency",       type=float, default=0.02, help="seconds added to every response")
+    parser.add_argument("--error-rate",    type=float, default=0.0,  help="fraction of Events.json requests failing with 500")
+    parser.add_argument("--throttle-rate", type=float, default=0.0,  help="fraction of Events.json requests rejected with 429")
+    parser.add_argument("--port",          type=int,   default=0)
+    parser.add_argument("--keep",          action="store_true", help="keep the run directory")
+    parser.add_argument("cantv_args",      nargs="*")
+
+    options = parser.parse_args()
+    stats   = Stats()
+    binary  = os.path.abspath(options.binary)
+
+    server = Server(("127.0.0.1", options.port), make_handler(options, stats))
+
+    threading.Thread(target=server.serve_forever, daemon=True).start()
+
+    base_url = "http://127.0.0.1:%d" % server.server_address[1]
+    run_dir  = tempfile.mkdtemp(prefix="cantv-bench-")
+
+    command = [binary, "-B", base_url, "-a", ACCOUNT, "-k", APIKEY, "-t", "", "-o", "",
+               "-s", "2021-03-01", "-e", "2021-03-31"] + options.cantv_args
+
+    with open(os.path.join(run_dir, "stderr.txt"), "w") as log:
+        start  = time.monotonic()
+        result = subprocess.run(command, cwd=run_dir, stdout=subprocess.DEVNULL, stderr=log)
+        wall   = time.monotonic() - start
+
+    server.shutdown()
+
+    # ru_maxrss is in kilobytes on Linux
+
+    peak_rss = resource.getrusage(resource.RUSAGE_CHILDREN).ru_maxrss / 1024.0
+    counted  = counted_calls(os.path.join(run_dir, "report.csv"))
+
+    # Requests failed with --error-rate aren't retried, every other call must be counted
+
+    lowest = options.calls - stats.errors if options.error_rate > 0 else options.calls
+    failure = None
+
+    if result.returncode != 0:
+        failure = "cantv exited with %d" % result.returncode
+    elif counted is None:
+        failure = "no report.csv with a Total row in %s" % run_dir
+    elif not lowest <= counted <= options.calls:
+        failure = "%d calls counted, expected %d" % (counted, options.calls)
+
+    counted = counted or 0
+
+    print("Exit code  : %d" % result.returncode)
+    print("Calls      : %d served, %d counted" % (options.calls, counted))
+    print("Requests   : %d pages, %d events, %d errors, %d throttled" % (stats.pages, stats.events, stats.errors, stats.throttled))
+    print("Wall Time  : %.3f s" % wall)
+    print("Calls/Sec  : %.1f" % (counted / wall if wall > 0 else 0))
+    print("Peak RSS   : %.1f MB" % peak_rss)
+    print("Run Dir    : %s" % (run_dir if options.keep or failure else "(removed)"))
+
+    if failure:
+        print("Failed     : %s, run directory kept" % failure, file=sys.stderr)
+        return 1
+
+    if not options.keep:
+        subprocess.run(["rm", "-rf", run_dir])
+
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,121 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+
+#include "arena.h"
+
+#define ARENA_ALIGN 16
+
+void ArenaInit(Arena *pArena, size_t blockSize)
+{
+    pArena->pHead     = NULL;
+    pArena->blockSize = blockSize;
+}
+
+void *ArenaAlloc(Arena *pArena, size_t size)
+{
+    size = (size + ARENA_ALIGN - 1) & ~((size_t) ARENA_ALIGN - 1);
+
+    ArenaBlock *pBlock = pArena->pHead;
+
+    if (!pBlock || pBlock->used + size > pBlock->size)
+    {
+        size_t blockSize = size > pArena->blockSize ? size : pArena->blockSize;
+
+        pBlock = malloc(sizeof(ArenaBlock) + blockSize);
+
+        if (!pBlock)
+        {
+            fprintf(stderr, "Failure allocating %zu bytes in ArenaAlloc\n", blockSize);
+            return NULL;
+        }
+
+        pBlock->pNext = pArena->pHead;
+        pBlock->size  = blockSize;
+        pBlock->used  = 0;
+
+        pArena->pHead = pBlock;
+    }
+
+    void *pMemory = pBlock->data + pBlock->used;
+
+    pBlock->used += size;
+
+    return pMemory;
+}
+
+char *ArenaStrndup(Arena *pArena, const char *pString, size_t length)
+{
+    char *pCopy = ArenaAlloc(pArena, length + 1);
+
+    if (pCopy)
+    {
+        memcpy(pCopy, pString, length);
+
+        pCopy[length] = 0;
+    }
+
+    return pCopy;
+}
+
+char *ArenaPrintf(Arena *pArena, const char *pFormat, ...)
+{
+    va_list argp;
+    va_start(argp, pFormat);
+
+    int len = vsnprintf(NULL, 0, pFormat, argp);
+
+    va_end(argp);
+
+    if (len < 0)
+    {
+        fprintf(stderr, "Error formatting string in ArenaPrintf\n");
+        return NULL;
+    }
+
+    char *pString = ArenaAlloc(pArena, len + 1);
+
+    if (pString)
+    {
+        va_start(argp, pFormat);
+        vsnprintf(pString, len + 1, pFormat, argp);
+        va_end(argp);
+    }
+
+    return pString;
+}
+
+void ArenaReset(Arena *pArena)
+{
+    ArenaBlock *pBlock = pArena->pHead;
+
+    if (!pBlock)
+    {
+        return;
+    }
+
+    while (pBlock->pNext)
+    {
+        ArenaBlock *pNext = pBlock->pNext;
+
+        free(pBlock);
+
+        pBlock = pNext;
+    }
+
+    pBlock->used  = 0;
+    pArena->pHead = pBlock;
+}
+
+void ArenaFree(Arena *pArena)
+{
+    while (pArena->pHead)
+    {
+        ArenaBlock *pNext = pArena->pHead->pNext;
+
+        free(pArena->pHead);
+
+        pArena->pHead = pNext;
+    }
+}
@@ -0,0 +1,32 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+
+// Bump allocator for short lived strings, everything is released at once by
+// ArenaReset or ArenaFree
+
+typedef struct ArenaBlock
+{
+    struct ArenaBlock *pNext;
+    size_t            size, used;
+    char              data[];
+} ArenaBlock;
+
+typedef struct
+{
+    ArenaBlock *pHead;
+    size_t     blockSize;
+} Arena;
+
+void  ArenaInit(Arena *pArena, size_t blockSize);
+void *ArenaAlloc(Arena *pArena, size_t size);
+char *ArenaStrndup(Arena *pArena, const char *pString, size_t length);
+char *ArenaPrintf(Arena *pArena, const char *pFormat, ...);
+
+// Keeps the first block for reuse and frees the rest
+
+void  ArenaReset(Arena *pArena);
+void  ArenaFree(Arena *pArena);
+
+#endif
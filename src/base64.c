@@ -0,0 +1,362 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define BASE64_X86
+#endif
+
+#include "base64.h"
+
+static char *decoding_table = NULL;
+
+static char encoding_table[] = {'A', 'B', 'C', 'D', 'E', 'F', 'G', 'H',
+                                'I', 'J', 'K', 'L', 'M', 'N', 'O', 'P',
+                                'Q', 'R', 'S', 'T', 'U', 'V', 'W', 'X',
+                                'Y', 'Z', 'a', 'b', 'c', 'd', 'e', 'f',
+                                'g', 'h', 'i', 'j', 'k', 'l', 'm', 'n',
+                                'o', 'p', 'q', 'r', 's', 't', 'u', 'v',
+                                'w', 'x', 'y', 'z', '0', '1', '2', '3',
+                                '4', '5', '6', '7', '8', '9', '+', '/'};
+
+void build_decoding_table() 
+{
+    decoding_table = malloc(256);
+
+    for (int i = 0; i < 64; i++)
+    {
+        decoding_table[(unsigned char) encoding_table[i]] = i;
+    }
+}
+
+void base64_cleanup() 
+{
+    free(decoding_table);
+}
+
+static int mod_table[] = {0, 2, 1};
+
+char *base64_encode(const unsigned char *data, size_t input_length, size_t *output_length) 
+{
+    *output_length = 4 * ((input_length + 2) / 3);
+
+    char *encoded_data = malloc(*output_length);
+
+    if (encoded_data == NULL) return NULL;
+
+    for (int i = 0, j = 0; i < input_length;) {
+
+        uint32_t octet_a = i < input_length ? (unsigned char)data[i++] : 0;
+        uint32_t octet_b = i < input_length ? (unsigned char)data[i++] : 0;
+        uint32_t octet_c = i < input_length ? (unsigned char)data[i++] : 0;
+
+        uint32_t triple = (octet_a << 0x10) + (octet_b << 0x08) + octet_c;
+
+        encoded_data[j++] = encoding_table[(triple >> 3 * 6) & 0x3F];
+        encoded_data[j++] = encoding_table[(triple >> 2 * 6) & 0x3F];
+        encoded_data[j++] = encoding_table[(triple >> 1 * 6) & 0x3F];
+        encoded_data[j++] = encoding_table[(triple >> 0 * 6) & 0x3F];
+    }
+
+    for (int i = 0; i < mod_table[input_length % 3]; i++)
+        encoded_data[*output_length - 1 - i] = '=';
+
+    return encoded_data;
+}
+
+unsigned char *base64_decode(const char *data,
+                             size_t input_length,
+                             size_t *output_length) {
+
+    if (decoding_table == NULL) build_decoding_table();
+
+    if (input_length % 4 != 0) return NULL;
+
+    *output_length = input_length / 4 * 3;
+    if (data[input_length - 1] == '=') (*output_length)--;
+    if (data[input_length - 2] == '=') (*output_length)--;
+
+    unsigned char *decoded_data = malloc(*output_length);
+    if (decoded_data == NULL) return NULL;
+
+    for (int i = 0, j = 0; i < input_length;) {
+
+        uint32_t sextet_a = data[i] == '=' ? 0 & i++ : decoding_table[data[i++]];
+        uint32_t sextet_b = data[i] == '=' ? 0 & i++ : decoding_table[data[i++]];
+        uint32_t sextet_c = data[i] == '=' ? 0 & i++ : decoding_table[data[i++]];
+        uint32_t sextet_d = data[i] == '=' ? 0 & i++ : decoding_table[data[i++]];
+
+        uint32_t triple = (sextet_a << 3 * 6)
+        + (sextet_b << 2 * 6)
+        + (sextet_c << 1 * 6)
+        + (sextet_d << 0 * 6);
+
+        if (j < *output_length) decoded_data[j++] = (triple >> 2 * 8) & 0xFF;
+        if (j < *output_length) decoded_data[j++] = (triple >> 1 * 8) & 0xFF;
+        if (j < *output_length) decoded_data[j++] = (triple >> 0 * 8) & 0xFF;
+    }
+
+    return decoded_data;
+}
+
+
+// Encodes whole and partial triples with '=' padding
+
+static char *EncodeScalar(const unsigned char *pData, size_t dataLen, char *pOut)
+{
+    size_t index = 0;
+
+    for (; index + 3 <= dataLen; index += 3)
+    {
+        uint32_t triple = (pData[index] << 16) | (pData[index + 1] << 8) | pData[index + 2];
+
+        *pOut++ = encoding_table[(triple >> 18) & 0x3F];
+        *pOut++ = encoding_table[(triple >> 12) & 0x3F];
+        *pOut++ = encoding_table[(triple >>  6) & 0x3F];
+        *pOut++ = encoding_table[ triple        & 0x3F];
+    }
+
+    if (index < dataLen)
+    {
+        uint32_t triple = pData[index] << 16;
+
+        if (index + 1 < dataLen)
+        {
+            triple |= pData[index + 1] << 8;
+        }
+
+        *pOut++ = encoding_table[(triple >> 18) & 0x3F];
+        *pOut++ = encoding_table[(triple >> 12) & 0x3F];
+        *pOut++ = index + 1 < dataLen ? encoding_table[(triple >> 6) & 0x3F] : '=';
+        *pOut++ = '=';
+    }
+
+    return pOut;
+}
+
+// A kernel encodes one full line, 57 bytes into 76 chars, and may load up to
+// BASE64_KERNEL_READ bytes from pData. The last 9 bytes are covered by a block
+// starting at byte 45 whose first 4 chars repeat ones already written.
+
+#define BASE64_KERNEL_READ 64
+
+typedef void (*Base64LineFunc)(const unsigned char *pData, char *pOut);
+
+static void EncodeLineScalar(const unsigned char *pData, char *pOut)
+{
+    EncodeScalar(pData, BASE64_LINE_BYTES, pOut);
+}
+
+#ifdef BASE64_X86
+
+// Byte shuffle, multiply shift and pshufb lookup after Mula and Lemire,
+// "Faster Base64 Encoding and Decoding using AVX2 Instructions"
+
+__attribute__((target("ssse3")))
+static __m128i EncodeBlockSSSE3(__m128i input)
+{
+    input = _mm_shuffle_epi8(input, _mm_set_epi8(10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3, 4, 1, 2, 0, 1));
+
+    __m128i high    = _mm_mulhi_epu16(_mm_and_si128(input, _mm_set1_epi32(0x0FC0FC00)), _mm_set1_epi32(0x04000040));
+    __m128i low     = _mm_mullo_epi16(_mm_and_si128(input, _mm_set1_epi32(0x003F03F0)), _mm_set1_epi32(0x01000010));
+    __m128i indices = _mm_or_si128(high, low);
+
+    __m128i shiftLUT = _mm_setr_epi8('a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+                                     '0' - 52, '0' - 52, '0' - 52, '+' - 62, '/' - 63, 'A', 0, 0);
+
+    __m128i shift = _mm_subs_epu8(indices, _mm_set1_epi8(51));
+    __m128i below = _mm_cmpgt_epi8(_mm_set1_epi8(26), indices);
+
+    shift = _mm_or_si128(shift, _mm_and_si128(below, _mm_set1_epi8(13)));
+
+    return _mm_add_epi8(indices, _mm_shuffle_epi8(shiftLUT, shift));
+}
+
+__attribute__((target("ssse3")))
+static void EncodeLineSSSE3(const unsigned char *pData, char *pOut)
+{
+    for (int block=0; block<4; block++)
+    {
+        __m128i input = _mm_loadu_si128((const __m128i *) (pData + block * 12));
+
+        _mm_storeu_si128((__m128i *) (pOut + block * 16), EncodeBlockSSSE3(input));
+    }
+
+    _mm_storeu_si128((__m128i *) (pOut + 60), EncodeBlockSSSE3(_mm_loadu_si128((const __m128i *) (pData + 45))));
+}
+
+__attribute__((target("avx2")))
+static __m256i EncodeBlockAVX2(__m256i input)
+{
+    input = _mm256_shuffle_epi8(input, _mm256_set_epi8(10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3, 4, 1, 2, 0, 1,
+                                                       10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3, 4, 1, 2, 0, 1));
+
+    __m256i high    = _mm256_mulhi_epu16(_mm256_and_si256(input, _mm256_set1_epi32(0x0FC0FC00)), _mm256_set1_epi32(0x04000040));
+    __m256i low     = _mm256_mullo_epi16(_mm256_and_si256(input, _mm256_set1_epi32(0x003F03F0)), _mm256_set1_epi32(0x01000010));
+    __m256i indices = _mm256_or_si256(high, low);
+
+    __m256i shiftLUT = _mm256_setr_epi8('a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+                                        '0' - 52, '0' - 52, '0' - 52, '+' - 62, '/' - 63, 'A', 0, 0,
+                                        'a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+                                        '0' - 52, '0' - 52, '0' - 52, '+' - 62, '/' - 63, 'A', 0, 0);
+
+    __m256i shift = _mm256_subs_epu8(indices, _mm256_set1_epi8(51));
+    __m256i below = _mm256_cmpgt_epi8(_mm256_set1_epi8(26), indices);
+
+    shift = _mm256_or_si256(shift, _mm256_and_si256(below, _mm256_set1_epi8(13)));
+
+    return _mm256_add_epi8(indices, _mm256_shuffle_epi8(shiftLUT, shift));
+}
+
+__attribute__((target("avx2")))
+static void EncodeLineAVX2(const unsigned char *pData, char *pOut)
+{
+    for (int block=0; block<2; block++)
+    {
+        const unsigned char *pBlock = pData + block * 24;
+
+        __m256i input = _mm256_inserti128_si256(_mm256_castsi128_si256(_mm_loadu_si128((const __m128i *) pBlock)),
+                                                _mm_loadu_si128((const __m128i *) (pBlock + 12)), 1);
+
+        _mm256_storeu_si256((__m256i *) (pOut + block * 32), EncodeBlockAVX2(input));
+    }
+
+    _mm_storeu_si128((__m128i *) (pOut + 60), EncodeBlockSSSE3(_mm_loadu_si128((const __m128i *) (pData + 45))));
+}
+
+#endif
+
+static Base64LineFunc s_pEncodeLine;
+static Base64Kernel   s_kernel;
+
+static bool KernelSupported(Base64Kernel kernel)
+{
+#ifdef BASE64_X86
+    __builtin_cpu_init();
+
+    if (kernel == BASE64_AVX2)
+    {
+        return __builtin_cpu_supports("avx2");
+    }
+
+    if (kernel == BASE64_SSSE3)
+    {
+        return __builtin_cpu_supports("ssse3");
+    }
+#endif
+
+    return kernel == BASE64_SCALAR;
+}
+
+bool Base64SetKernel(Base64Kernel kernel)
+{
+    if (!KernelSupported(kernel))
+    {
+        return false;
+    }
+
+    s_kernel = kernel;
+
+    switch (kernel)
+    {
+#ifdef BASE64_X86
+        case BASE64_AVX2:
+            s_pEncodeLine = EncodeLineAVX2;
+            break;
+
+        case BASE64_SSSE3:
+            s_pEncodeLine = EncodeLineSSSE3;
+            break;
+#endif
+        default:
+            s_pEncodeLine = EncodeLineScalar;
+            break;
+    }
+
+    return true;
+}
+
+Base64Kernel Base64GetKernel(void)
+{
+    if (!s_pEncodeLine && !Base64SetKernel(BASE64_AVX2) && !Base64SetKernel(BASE64_SSSE3))
+    {
+        Base64SetKernel(BASE64_SCALAR);
+    }
+
+    return s_kernel;
+}
+
+const char *Base64KernelName(Base64Kernel kernel)
+{
+    switch (kernel)
+    {
+        case BASE64_AVX2:  return "avx2";
+        case BASE64_SSSE3: return "ssse3";
+        default:           return "scalar";
+    }
+}
+
+size_t Base64WrappedLength(size_t dataLen)
+{
+    size_t chars = 4 * ((dataLen + 2) / 3);
+
+    return chars + 2 * ((chars + BASE64_LINE_CHARS - 1) / BASE64_LINE_CHARS);
+}
+
+size_t Base64EncodeWrappedTo(const unsigned char *pData, size_t dataLen, char *pOut)
+{
+    Base64GetKernel();
+
+    char *pStart = pOut;
+
+    for (; dataLen >= BASE64_LINE_BYTES; dataLen -= BASE64_LINE_BYTES, pData += BASE64_LINE_BYTES)
+    {
+        if (dataLen >= BASE64_KERNEL_READ)
+        {
+            s_pEncodeLine(pData, pOut);
+        }
+        else
+        {
+            EncodeLineScalar(pData, pOut);
+        }
+
+        pOut += BASE64_LINE_CHARS;
+
+        *pOut++ = '\r';
+        *pOut++ = '\n';
+    }
+
+    if (dataLen > 0)
+    {
+        pOut = EncodeScalar(pData, dataLen, pOut);
+
+        *pOut++ = '\r';
+        *pOut++ = '\n';
+    }
+
+    *pOut = '\0';
+
+    return pOut - pStart;
+}
+
+char *Base64EncodeWrapped(const unsigned char *pData, size_t dataLen, size_t *pEncodedLen)
+{
+    char *pEncoded = malloc(Base64WrappedLength(dataLen) + 1);
+
+    if (!pEncoded)
+    {
+        fprintf(stderr, "Failure allocating %zu bytes for base64\n", Base64WrappedLength(dataLen) + 1);
+        return NULL;
+    }
+
+    size_t encodedLen = Base64EncodeWrappedTo(pData, dataLen, pEncoded);
+
+    if (pEncodedLen)
+    {
+        *pEncodedLen = encodedLen;
+    }
+
+    return pEncoded;
+}
@@ -0,0 +1,39 @@
+#ifndef BASE64_H
+#define BASE64_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+// Unwrapped encoder, output is not NUL terminated
+
+char          *base64_encode(const unsigned char *data, size_t input_length, size_t *output_length);
+unsigned char *base64_decode(const char *data, size_t input_length, size_t *output_length);
+void           base64_cleanup();
+
+// RFC 2045 encoder: 76 column lines each ending in CRLF, NUL terminated.
+// The kernel is picked from the CPU on first use.
+
+#define BASE64_LINE_CHARS 76
+#define BASE64_LINE_BYTES 57
+
+typedef enum
+{
+    BASE64_SCALAR,
+    BASE64_SSSE3,
+    BASE64_AVX2
+} Base64Kernel;
+
+size_t Base64WrappedLength(size_t dataLen);
+
+// pOut must hold Base64WrappedLength(dataLen) + 1 chars, returns the length written
+
+size_t Base64EncodeWrappedTo(const unsigned char *pData, size_t dataLen, char *pOut);
+char  *Base64EncodeWrapped(const unsigned char *pData, size_t dataLen, size_t *pEncodedLen);
+
+// False if the CPU lacks the kernel, mainly for the benchmark
+
+bool         Base64SetKernel(Base64Kernel kernel);
+Base64Kernel Base64GetKernel(void);
+const char  *Base64KernelName(Base64Kernel kernel);
+
+#endif
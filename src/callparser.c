@@ -0,0 +1,479 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cantv.h"
+#include "callparser.h"
+
+enum
+{
+    PS_VALUE,
+    PS_ARRAY_START,
+    PS_OBJECT_START,
+    PS_KEY,
+    PS_COLON,
+    PS_AFTER_VALUE,
+    PS_STRING,
+    PS_ESCAPE,
+    PS_UNICODE,
+    PS_LITERAL,
+    PS_DONE
+};
+
+void CallParserInit(CallParser *pParser, CallParserEmit pEmit, void *pUserData)
+{
+    memset(pParser, 0, sizeof(CallParser));
+
+    pParser->pEmit     = pEmit;
+    pParser->pUserData = pUserData;
+    pParser->state     = PS_VALUE;
+}
+
+void CallParserCleanup(CallParser *pParser)
+{
+    CallRecordFree(pParser->pRecord);
+
+    pParser->pRecord = NULL;
+
+    FreeString(&pParser->pNextURI);
+    FreeString(&pParser->pValue);
+}
+
+bool CallParserDone(CallParser *pParser)
+{
+    return !pParser->bError && pParser->state == PS_DONE;
+}
+
+static bool IsSpace(char c)
+{
+    return c == ' ' || c == '\t' || c == '\r' || c == '\n';
+}
+
+static void AppendByte(CallParser *pParser, char c)
+{
+    if (pParser->bKey)
+    {
+        if (pParser->keyLen < CALL_PARSER_MAX_KEY - 1)
+        {
+            pParser->key[pParser->keyLen] = c;
+        }
+
+        pParser->keyLen++;
+    }
+    else if (pParser->ppTarget)
+    {
+        if (pParser->valueLen + 1 >= pParser->valueCap)
+        {
+            size_t newCap = pParser->valueCap ? pParser->valueCap * 2 : 128;
+
+            char *pNewValue = realloc(pParser->pValue, newCap);
+
+            if (!pNewValue)
+            {
+                fprintf(stderr, "Failure allocating %zu bytes in CallParser\n", newCap);
+
+                pParser->bError = true;
+                return;
+            }
+
+            pParser->pValue   = pNewValue;
+            pParser->valueCap = newCap;
+        }
+
+        pParser->pValue[pParser->valueLen++] = c;
+    }
+}
+
+static void AppendCodepoint(CallParser *pParser, unsigned int codepoint)
+{
+    if (codepoint < 0x80)
+    {
+        AppendByte(pParser, codepoint);
+    }
+    else if (codepoint < 0x800)
+    {
+        AppendByte(pParser, 0xC0 | (codepoint >> 6));
+        AppendByte(pParser, 0x80 | (codepoint & 0x3F));
+    }
+    else if (codepoint < 0x10000)
+    {
+        AppendByte(pParser, 0xE0 | (codepoint >> 12));
+        AppendByte(pParser, 0x80 | ((codepoint >> 6) & 0x3F));
+        AppendByte(pParser, 0x80 | (codepoint & 0x3F));
+    }
+    else
+    {
+        AppendByte(pParser, 0xF0 | (codepoint >> 18));
+        AppendByte(pParser, 0x80 | ((codepoint >> 12) & 0x3F));
+        AppendByte(pParser, 0x80 | ((codepoint >> 6) & 0x3F));
+        AppendByte(pParser, 0x80 | (codepoint & 0x3F));
+    }
+}
+
+static void FlushSurrogate(CallParser *pParser)
+{
+    if (pParser->highSurrogate)
+    {
+        AppendCodepoint(pParser, 0xFFFD);
+
+        pParser->highSurrogate = 0;
+    }
+}
+
+static char **FieldTarget(CallRecord *pRecord, const char *pKey)
+{
+    if (strcmp(pKey, "sid")            == 0) return &pRecord->pSID;
+    if (strcmp(pKey, "from_formatted") == 0) return &pRecord->pFrom;
+    if (strcmp(pKey, "to_formatted")   == 0) return &pRecord->pTo;
+    if (strcmp(pKey, "start_time")     == 0) return &pRecord->pStart;
+    if (strcmp(pKey, "end_time")       == 0) return &pRecord->pEnd;
+    if (strcmp(pKey, "duration")       == 0) return &pRecord->pDuration;
+
+    return NULL;
+}
+
+static void EndValue(CallParser *pParser)
+{
+    pParser->state = pParser->depth == 0 ? PS_DONE : PS_AFTER_VALUE;
+}
+
+static void EndString(CallParser *pParser)
+{
+    FlushSurrogate(pParser);
+
+    if (pParser->bKey)
+    {
+        const char *pKey = pParser->keyLen < CALL_PARSER_MAX_KEY ? pParser->key : "";
+
+        pParser->key[pParser->keyLen < CALL_PARSER_MAX_KEY ? pParser->keyLen : 0] = 0;
+
+        if (pParser->depth == 1)
+        {
+            strcpy(pParser->topKey, pKey);
+        }
+        else if (pParser->depth == 3)
+        {
+            strcpy(pParser->fieldKey, pKey);
+        }
+
+        pParser->bKey  = false;
+        pParser->state = PS_COLON;
+        return;
+    }
+
+    if (pParser->ppTarget)
+    {
+        const char *pValue = pParser->pValue ? pParser->pValue : "";
+
+        if (pParser->ppTarget == &pParser->pNextURI)
+        {
+            FreeString(pParser->ppTarget);
+
+            *pParser->ppTarget = strndup(pValue, pParser->valueLen);
+        }
+        else
+        {
+            *pParser->ppTarget = ArenaStrndup(&pParser->pRecord->arena, pValue, pParser->valueLen);
+        }
+
+        pParser->ppTarget = NULL;
+    }
+
+    EndValue(pParser);
+}
+
+static void EmitRecord(CallParser *pParser)
+{
+    CallRecord *pRecord = pParser->pRecord;
+
+    pParser->pRecord = NULL;
+
+    if (pRecord->pSID && pRecord->pFrom && pRecord->pTo && pRecord->pStart && pRecord->pEnd && pRecord->pDuration)
+    {
+        pParser->pEmit(pRecord, pParser->pUserData);
+    }
+    else
+    {
+        CallRecordFree(pRecord);
+    }
+}
+
+static void BeginContainer(CallParser *pParser, char c)
+{
+    if (pParser->depth == CALL_PARSER_MAX_DEPTH)
+    {
+        pParser->bError = true;
+        return;
+    }
+
+    if (c == '[' && pParser->depth == 1 && strcmp(pParser->topKey, "calls") == 0)
+    {
+        pParser->bInCalls = true;
+    }
+    else if (c == '{' && pParser->depth == 2 && pParser->bInCalls)
+    {
+        pParser->pRecord = CallRecordNew();
+    }
+
+    pParser->stack[pParser->depth++] = c;
+    pParser->state = c == '{' ? PS_OBJECT_START : PS_ARRAY_START;
+}
+
+static void EndContainer(CallParser *pParser, char c)
+{
+    if (pParser->depth == 0 || pParser->stack[pParser->depth - 1] != (c == '}' ? '{' : '['))
+    {
+        pParser->bError = true;
+        return;
+    }
+
+    pParser->depth--;
+
+    if (c == '}' && pParser->depth == 2 && pParser->pRecord)
+    {
+        EmitRecord(pParser);
+    }
+    else if (c == ']' && pParser->depth == 1)
+    {
+        pParser->bInCalls = false;
+    }
+
+    EndValue(pParser);
+}
+
+static void BeginValue(CallParser *pParser, char c)
+{
+    if (c == '"')
+    {
+        pParser->ppTarget = NULL;
+        pParser->valueLen = 0;
+
+        if (pParser->depth == 1 && strcmp(pParser->topKey, "next_page_uri") == 0)
+        {
+            pParser->ppTarget = &pParser->pNextURI;
+        }
+        else if (pParser->depth == 3 && pParser->pRecord)
+        {
+            pParser->ppTarget = FieldTarget(pParser->pRecord, pParser->fieldKey);
+        }
+
+        pParser->state = PS_STRING;
+    }
+    else if (c == '{' || c == '[')
+    {
+        BeginContainer(pParser, c);
+    }
+    else if (c == '-' || (c >= '0' && c <= '9') || (c >= 'a' && c <= 'z'))
+    {
+        pParser->state = PS_LITERAL;
+    }
+    else
+    {
+        pParser->bError = true;
+    }
+}
+
+static int HexValue(char c)
+{
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+
+    return -1;
+}
+
+bool CallParserFeed(CallParser *pParser, const char *pData, size_t dataLen)
+{
+    for (size_t index=0; index<dataLen && !pParser->bError; index++)
+    {
+        char c = pData[index];
+
+        switch (pParser->state)
+        {
+            case PS_STRING:
+                if (c == '"')
+                {
+                    EndString(pParser);
+                }
+                else if (c == '\\')
+                {
+                    pParser->state = PS_ESCAPE;
+                }
+                else if ((unsigned char) c < 0x20)
+                {
+                    pParser->bError = true;
+                }
+                else
+                {
+                    FlushSurrogate(pParser);
+                    AppendByte(pParser, c);
+                }
+                break;
+
+            case PS_ESCAPE:
+                pParser->state = PS_STRING;
+
+                if (c == 'u')
+                {
+                    pParser->codepoint = 0;
+                    pParser->hexDigits = 0;
+                    pParser->state     = PS_UNICODE;
+                    break;
+                }
+
+                FlushSurrogate(pParser);
+
+                switch (c)
+                {
+                    case '"':  AppendByte(pParser, '"');  break;
+                    case '\\': AppendByte(pParser, '\\'); break;
+                    case '/':  AppendByte(pParser, '/');  break;
+                    case 'b':  AppendByte(pParser, '\b'); break;
+                    case 'f':  AppendByte(pParser, '\f'); break;
+                    case 'n':  AppendByte(pParser, '\n'); break;
+                    case 'r':  AppendByte(pParser, '\r'); break;
+                    case 't':  AppendByte(pParser, '\t'); break;
+                    default:   pParser->bError = true;   break;
+                }
+                break;
+
+            case PS_UNICODE:
+            {
+                int hex = HexValue(c);
+
+                if (hex < 0)
+                {
+                    pParser->bError = true;
+                    break;
+                }
+
+                pParser->codepoint = (pParser->codepoint << 4) | hex;
+
+                if (++pParser->hexDigits < 4)
+                {
+                    break;
+                }
+
+                unsigned int codepoint = pParser->codepoint;
+
+                if (codepoint >= 0xD800 && codepoint <= 0xDBFF)
+                {
+                    FlushSurrogate(pParser);
+
+                    pParser->highSurrogate = codepoint;
+                }
+                else if (codepoint >= 0xDC00 && codepoint <= 0xDFFF)
+                {
+                    if (pParser->highSurrogate)
+                    {
+                        AppendCodepoint(pParser, 0x10000 + ((pParser->highSurrogate - 0xD800) << 10) + (codepoint - 0xDC00));
+
+                        pParser->highSurrogate = 0;
+                    }
+                    else
+                    {
+                        AppendCodepoint(pParser, 0xFFFD);
+                    }
+                }
+                else
+                {
+                    FlushSurrogate(pParser);
+                    AppendCodepoint(pParser, codepoint);
+                }
+
+                pParser->state = PS_STRING;
+                break;
+            }
+
+            case PS_LITERAL:
+                if ((c >= '0' && c <= '9') || (c >= 'a' && c <= 'z') || c == '.' || c == '-' || c == '+' || c == 'E')
+                {
+                    break;
+                }
+
+                EndValue(pParser);
+                index--;
+                break;
+
+            case PS_VALUE:
+                if (!IsSpace(c))
+                {
+                    BeginValue(pParser, c);
+                }
+                break;
+
+            case PS_ARRAY_START:
+                if (c == ']')
+                {
+                    EndContainer(pParser, c);
+                }
+                else if (!IsSpace(c))
+                {
+                    BeginValue(pParser, c);
+                }
+                break;
+
+            case PS_OBJECT_START:
+            case PS_KEY:
+                if (c == '"')
+                {
+                    pParser->bKey   = true;
+                    pParser->keyLen = 0;
+                    pParser->state  = PS_STRING;
+                }
+                else if (c == '}' && pParser->state == PS_OBJECT_START)
+                {
+                    EndContainer(pParser, c);
+                }
+                else if (!IsSpace(c))
+                {
+                    pParser->bError = true;
+                }
+                break;
+
+            case PS_COLON:
+                if (c == ':')
+                {
+                    pParser->state = PS_VALUE;
+                }
+                else if (!IsSpace(c))
+                {
+                    pParser->bError = true;
+                }
+                break;
+
+            case PS_AFTER_VALUE:
+                if (c == ',')
+                {
+                    pParser->state = pParser->stack[pParser->depth - 1] == '{' ? PS_KEY : PS_VALUE;
+                }
+                else if (c == '}' || c == ']')
+                {
+                    EndContainer(pParser, c);
+                }
+                else if (!IsSpace(c))
+                {
+                    pParser->bError = true;
+                }
+                break;
+
+            case PS_DONE:
+                if (!IsSpace(c))
+                {
+                    pParser->bError = true;
+                }
+                break;
+        }
+    }
+
+    return !pParser->bError;
+}
+
+size_t CallParserWrite(char *ptr, size_t size, size_t nmemb, void *pUserData)
+{
+    CallParser *pParser = (CallParser *) pUserData;
+
+    CallParserFeed(pParser, ptr, size * nmemb);
+
+    return size * nmemb;
+}
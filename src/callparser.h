@@ -0,0 +1,55 @@
+#ifndef CALLPARSER_H
+#define CALLPARSER_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "callqueue.h"
+
+#define CALL_PARSER_MAX_DEPTH 64
+#define CALL_PARSER_MAX_KEY   32
+
+// Incremental Calls.json parser fed straight from the curl write callback. Each
+// entry of the top level "calls" array is handed to pEmit as soon as its object
+// closes, only strings that are kept are ever buffered.
+
+typedef void (*CallParserEmit)(CallRecord *pRecord, void *pUserData);
+
+typedef struct
+{
+    CallParserEmit pEmit;
+    void           *pUserData;
+    char           *pNextURI;
+    bool           bError;
+
+    int            state;
+    char           stack[CALL_PARSER_MAX_DEPTH];
+    int            depth;
+    bool           bInCalls;
+    CallRecord     *pRecord;
+
+    bool           bKey;
+    char           key[CALL_PARSER_MAX_KEY];
+    int            keyLen;
+    char           topKey[CALL_PARSER_MAX_KEY];
+    char           fieldKey[CALL_PARSER_MAX_KEY];
+
+    char           **ppTarget;
+    char           *pValue;
+    size_t         valueLen, valueCap;
+
+    unsigned int   codepoint, highSurrogate;
+    int            hexDigits;
+} CallParser;
+
+void   CallParserInit(CallParser *pParser, CallParserEmit pEmit, void *pUserData);
+void   CallParserCleanup(CallParser *pParser);
+bool   CallParserFeed(CallParser *pParser, const char *pData, size_t dataLen);
+
+// Complete once the root value has closed without error
+
+bool   CallParserDone(CallParser *pParser);
+
+size_t CallParserWrite(char *ptr, size_t size, size_t nmemb, void *pUserData);
+
+#endif
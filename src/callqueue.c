@@ -0,0 +1,192 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <glib.h>
+
+#include "cantv.h"
+#include "callqueue.h"
+
+CallRecord *CallRecordNew(void)
+{
+    Arena arena;
+
+    ArenaInit(&arena, CALL_ARENA_SIZE);
+
+    CallRecord *pRecord = ArenaAlloc(&arena, sizeof(CallRecord));
+
+    if (!pRecord)
+    {
+        ArenaFree(&arena);
+        return NULL;
+    }
+
+    memset(pRecord, 0, sizeof(CallRecord));
+
+    pRecord->arena = arena;
+
+    return pRecord;
+}
+
+void CallRecordFree(CallRecord *pRecord)
+{
+    if (pRecord)
+    {
+        Arena arena = pRecord->arena;
+
+        ArenaFree(&arena);
+    }
+}
+
+CallQueue *CallQueueNew(int capacity)
+{
+    CallQueue *pQueue = calloc(1, sizeof(CallQueue));
+
+    if (!pQueue)
+    {
+        return NULL;
+    }
+
+    pQueue->capacity  = capacity > 0 ? capacity : 1;
+    pQueue->ppRecords = calloc(pQueue->capacity, sizeof(CallRecord *));
+
+    if (!pQueue->ppRecords)
+    {
+        free(pQueue);
+        return NULL;
+    }
+
+    g_mutex_init(&pQueue->lock);
+    g_cond_init(&pQueue->notEmpty);
+    g_cond_init(&pQueue->notFull);
+
+    return pQueue;
+}
+
+void CallQueueFree(CallQueue *pQueue)
+{
+    if (!pQueue)
+    {
+        return;
+    }
+
+    while (pQueue->count > 0)
+    {
+        CallRecordFree(pQueue->ppRecords[pQueue->head]);
+
+        pQueue->head = (pQueue->head + 1) % pQueue->capacity;
+        pQueue->count--;
+    }
+
+    g_cond_clear(&pQueue->notFull);
+    g_cond_clear(&pQueue->notEmpty);
+    g_mutex_clear(&pQueue->lock);
+
+    free(pQueue->ppRecords);
+    free(pQueue);
+}
+
+bool CallQueuePush(CallQueue *pQueue, CallRecord *pRecord)
+{
+    g_mutex_lock(&pQueue->lock);
+
+    while (pQueue->count == pQueue->capacity && !pQueue->bClosed)
+    {
+        g_cond_wait(&pQueue->notFull, &pQueue->lock);
+    }
+
+    bool bPushed = !pQueue->bClosed;
+
+    if (bPushed)
+    {
+        pQueue->ppRecords[(pQueue->head + pQueue->count) % pQueue->capacity] = pRecord;
+        pQueue->count++;
+
+        g_cond_signal(&pQueue->notEmpty);
+    }
+
+    g_mutex_unlock(&pQueue->lock);
+
+    return bPushed;
+}
+
+bool CallQueueTryPush(CallQueue *pQueue, CallRecord *pRecord, bool *pbClosed)
+{
+    g_mutex_lock(&pQueue->lock);
+
+    bool bPushed = !pQueue->bClosed && pQueue->count < pQueue->capacity;
+
+    if (bPushed)
+    {
+        pQueue->ppRecords[(pQueue->head + pQueue->count) % pQueue->capacity] = pRecord;
+        pQueue->count++;
+
+        g_cond_signal(&pQueue->notEmpty);
+    }
+
+    *pbClosed = pQueue->bClosed;
+
+    g_mutex_unlock(&pQueue->lock);
+
+    return bPushed;
+}
+
+CallRecord *CallQueuePop(CallQueue *pQueue)
+{
+    CallRecord *pRecord = NULL;
+
+    g_mutex_lock(&pQueue->lock);
+
+    while (pQueue->count == 0 && !pQueue->bClosed)
+    {
+        g_cond_wait(&pQueue->notEmpty, &pQueue->lock);
+    }
+
+    if (pQueue->count > 0)
+    {
+        pRecord = pQueue->ppRecords[pQueue->head];
+
+        pQueue->head = (pQueue->head + 1) % pQueue->capacity;
+        pQueue->count--;
+
+        g_cond_signal(&pQueue->notFull);
+    }
+
+    g_mutex_unlock(&pQueue->lock);
+
+    return pRecord;
+}
+
+CallRecord *CallQueueTryPop(CallQueue *pQueue, bool *pbClosed)
+{
+    CallRecord *pRecord = NULL;
+
+    g_mutex_lock(&pQueue->lock);
+
+    if (pQueue->count > 0)
+    {
+        pRecord = pQueue->ppRecords[pQueue->head];
+
+        pQueue->head = (pQueue->head + 1) % pQueue->capacity;
+        pQueue->count--;
+
+        g_cond_signal(&pQueue->notFull);
+    }
+
+    *pbClosed = pQueue->bClosed && pQueue->count == 0 && !pRecord;
+
+    g_mutex_unlock(&pQueue->lock);
+
+    return pRecord;
+}
+
+void CallQueueClose(CallQueue *pQueue)
+{
+    g_mutex_lock(&pQueue->lock);
+
+    pQueue->bClosed = true;
+
+    g_cond_broadcast(&pQueue->notEmpty);
+    g_cond_broadcast(&pQueue->notFull);
+
+    g_mutex_unlock(&pQueue->lock);
+}
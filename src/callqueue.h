@@ -0,0 +1,55 @@
+#ifndef CALLQUEUE_H
+#define CALLQUEUE_H
+
+#include <stdbool.h>
+#include <glib.h>
+
+#include "arena.h"
+
+#define CALL_ARENA_SIZE 1024
+
+// A call record lives inside its own arena, every string belonging to the call
+// is allocated there and released together by CallRecordFree
+
+typedef struct
+{
+    Arena arena;
+    char  *pSID, *pFrom, *pTo, *pStart, *pEnd, *pDuration;
+} CallRecord;
+
+CallRecord *CallRecordNew(void);
+void        CallRecordFree(CallRecord *pRecord);
+
+// Bounded producer/consumer queue between the listing and processing stages
+
+typedef struct
+{
+    GMutex     lock;
+    GCond      notEmpty, notFull;
+    CallRecord **ppRecords;
+    int        capacity, head, count;
+    bool       bClosed;
+} CallQueue;
+
+CallQueue *CallQueueNew(int capacity);
+void       CallQueueFree(CallQueue *pQueue);
+
+// Blocks while full, returns false if the queue was closed
+
+bool CallQueuePush(CallQueue *pQueue, CallRecord *pRecord);
+
+// Never blocks, false when full or closed with *pbClosed telling which
+
+bool CallQueueTryPush(CallQueue *pQueue, CallRecord *pRecord, bool *pbClosed);
+
+// Blocks while empty, returns NULL once closed and drained
+
+CallRecord *CallQueuePop(CallQueue *pQueue);
+
+// Never blocks, *pbClosed is set once the queue is closed and drained
+
+CallRecord *CallQueueTryPop(CallQueue *pQueue, bool *pbClosed);
+
+void CallQueueClose(CallQueue *pQueue);
+
+#endif
@@ -0,0 +1,436 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <glib.h>
+
+#include "cantv.h"
+#include "callstore.h"
+
+#define CALL_STORE_ROW_BYTES (sizeof(int64_t) + 2 * sizeof(int32_t) + sizeof(uint8_t) + CALL_STORE_SID_LEN)
+
+static size_t BlockBytes(uint32_t rows)
+{
+    return ((size_t) rows * CALL_STORE_ROW_BYTES + 7) & ~(size_t) 7;
+}
+
+typedef struct
+{
+    int64_t  *pStarts;
+    int32_t  *pKeys, *pDurations;
+    uint8_t  *pDays;
+    char     *pSIDs;
+} BlockColumns;
+
+static BlockColumns Columns(char *pBlock, uint32_t rows)
+{
+    BlockColumns columns;
+
+    columns.pStarts    = (int64_t *) pBlock;
+    columns.pKeys      = (int32_t *) (pBlock + rows * sizeof(int64_t));
+    columns.pDurations = columns.pKeys + rows;
+    columns.pDays      = (uint8_t *) (columns.pDurations + rows);
+    columns.pSIDs      = (char *) (columns.pDays + rows);
+
+    return columns;
+}
+
+static bool ValidHeader(const CallStoreHeader *pHeader)
+{
+    return pHeader->magic == CALL_STORE_MAGIC && pHeader->version == CALL_STORE_VERSION;
+}
+
+CallStore *CallStoreOpen(const char *pDirectory, const char *pAccount)
+{
+    if (mkdir(pDirectory, 0755) != 0 && errno != EEXIST)
+    {
+        fprintf(stderr, "Failure creating call store directory %s: %s\n", pDirectory, strerror(errno));
+        return NULL;
+    }
+
+    CallStore *pStore = calloc(1, sizeof(CallStore));
+
+    if (!pStore)
+    {
+        return NULL;
+    }
+
+    asprintf(&pStore->pDataPath,  "%s/%s.col", pDirectory, pAccount);
+    asprintf(&pStore->pIndexPath, "%s/%s.idx", pDirectory, pAccount);
+
+    pStore->dataFD  = open(pStore->pDataPath,  O_RDWR | O_CREAT, 0644);
+    pStore->indexFD = open(pStore->pIndexPath, O_RDWR | O_CREAT, 0644);
+
+    pStore->pStarts    = malloc(CALL_STORE_BLOCK_ROWS * sizeof(int64_t));
+    pStore->pKeys      = malloc(CALL_STORE_BLOCK_ROWS * sizeof(int32_t));
+    pStore->pDurations = malloc(CALL_STORE_BLOCK_ROWS * sizeof(int32_t));
+    pStore->pDays      = malloc(CALL_STORE_BLOCK_ROWS * sizeof(uint8_t));
+    pStore->pSIDs      = malloc(CALL_STORE_BLOCK_ROWS * CALL_STORE_SID_LEN);
+
+    struct stat dataStat, indexStat;
+
+    if (pStore->dataFD < 0 || pStore->indexFD < 0 || fstat(pStore->dataFD, &dataStat) != 0 || fstat(pStore->indexFD, &indexStat) != 0 ||
+        !pStore->pStarts || !pStore->pKeys || !pStore->pDurations || !pStore->pDays || !pStore->pSIDs)
+    {
+        fprintf(stderr, "Failure opening call store %s: %s\n", pStore->pDataPath, strerror(errno));
+
+        CallStoreClose(pStore);
+        return NULL;
+    }
+
+    CallStoreHeader header = { CALL_STORE_MAGIC, CALL_STORE_VERSION };
+
+    if (dataStat.st_size == 0 && indexStat.st_size == 0)
+    {
+        if (pwrite(pStore->dataFD, &header, sizeof(header), 0) != sizeof(header) || pwrite(pStore->indexFD, &header, sizeof(header), 0) != sizeof(header))
+        {
+            fprintf(stderr, "Failure writing %s: %s\n", pStore->pDataPath, strerror(errno));
+
+            CallStoreClose(pStore);
+            return NULL;
+        }
+
+        dataStat.st_size = indexStat.st_size = sizeof(header);
+    }
+
+    CallStoreHeader dataHeader, indexHeader;
+
+    if (pread(pStore->dataFD,  &dataHeader,  sizeof(dataHeader),  0) != sizeof(dataHeader)  || !ValidHeader(&dataHeader) ||
+        pread(pStore->indexFD, &indexHeader, sizeof(indexHeader), 0) != sizeof(indexHeader) || !ValidHeader(&indexHeader))
+    {
+        fprintf(stderr, "%s is not a call store this version can read\n", pStore->pDataPath);
+
+        CallStoreClose(pStore);
+        return NULL;
+    }
+
+    // Keeps the blocks that are complete and indexed, in order, and drops
+    // whatever a crash left behind them
+
+    pStore->dataSize  = sizeof(CallStoreHeader);
+    pStore->indexSize = sizeof(CallStoreHeader);
+
+    CallStoreBlock block;
+
+    while (pStore->indexSize + sizeof(block) <= (uint64_t) indexStat.st_size &&
+           pread(pStore->indexFD, &block, sizeof(block), pStore->indexSize) == sizeof(block) &&
+           block.offset == pStore->dataSize && block.rows > 0 && block.rows <= CALL_STORE_BLOCK_ROWS &&
+           block.offset + BlockBytes(block.rows) <= (uint64_t) dataStat.st_size)
+    {
+        pStore->dataSize  += BlockBytes(block.rows);
+        pStore->indexSize += sizeof(block);
+    }
+
+    if (pStore->dataSize < (uint64_t) dataStat.st_size || pStore->indexSize < (uint64_t) indexStat.st_size)
+    {
+        fprintf(stderr, "Call store %s had an incomplete block, dropping it\n", pStore->pDataPath);
+
+        if (ftruncate(pStore->dataFD, pStore->dataSize) != 0 || ftruncate(pStore->indexFD, pStore->indexSize) != 0)
+        {
+            fprintf(stderr, "Failure truncating %s: %s\n", pStore->pDataPath, strerror(errno));
+
+            CallStoreClose(pStore);
+            return NULL;
+        }
+    }
+
+    return pStore;
+}
+
+bool CallStoreAppend(CallStore *pStore, const char *pSID, time_t startTime, int day, int key, int duration)
+{
+    size_t sidLen = strlen(pSID);
+
+    if (sidLen > CALL_STORE_SID_LEN)
+    {
+        return false;
+    }
+
+    uint32_t row = pStore->rows;
+
+    pStore->pStarts[row]    = startTime;
+    pStore->pKeys[row]      = key;
+    pStore->pDurations[row] = duration;
+    pStore->pDays[row]      = day;
+
+    char *pRowSID = pStore->pSIDs + (size_t) row * CALL_STORE_SID_LEN;
+
+    memset(pRowSID, 0, CALL_STORE_SID_LEN);
+    memcpy(pRowSID, pSID, sidLen);
+
+    pStore->rows++;
+    pStore->appended++;
+
+    return pStore->rows < CALL_STORE_BLOCK_ROWS || CallStoreFlush(pStore);
+}
+
+typedef struct
+{
+    int64_t  start;
+    uint32_t row;
+} StartOrder;
+
+static int CompareStart(const void *pA, const void *pB)
+{
+    const StartOrder *pOrderA = (const StartOrder *) pA;
+    const StartOrder *pOrderB = (const StartOrder *) pB;
+
+    if (pOrderA->start != pOrderB->start)
+    {
+        return pOrderA->start < pOrderB->start ? -1 : 1;
+    }
+
+    return pOrderA->row < pOrderB->row ? -1 : pOrderA->row > pOrderB->row;
+}
+
+bool CallStoreFlush(CallStore *pStore)
+{
+    uint32_t rows = pStore->rows;
+
+    if (rows == 0)
+    {
+        return true;
+    }
+
+    // The rows are dropped even if writing fails so the buffer can't wedge
+
+    pStore->rows = 0;
+
+    size_t     blockBytes = BlockBytes(rows);
+    char       *pBlock    = calloc(1, blockBytes);
+    StartOrder *pOrder    = malloc(rows * sizeof(StartOrder));
+
+    if (!pBlock || !pOrder)
+    {
+        fprintf(stderr, "Failure allocating a call store block of %u rows\n", rows);
+
+        free(pBlock);
+        free(pOrder);
+        return false;
+    }
+
+    for (uint32_t row=0; row<rows; row++)
+    {
+        pOrder[row] = (StartOrder) { pStore->pStarts[row], row };
+    }
+
+    qsort(pOrder, rows, sizeof(StartOrder), CompareStart);
+
+    BlockColumns columns = Columns(pBlock, rows);
+
+    for (uint32_t index=0; index<rows; index++)
+    {
+        uint32_t row = pOrder[index].row;
+
+        columns.pStarts[index]    = pStore->pStarts[row];
+        columns.pKeys[index]      = pStore->pKeys[row];
+        columns.pDurations[index] = pStore->pDurations[row];
+        columns.pDays[index]      = pStore->pDays[row];
+
+        memcpy(columns.pSIDs + (size_t) index * CALL_STORE_SID_LEN, pStore->pSIDs + (size_t) row * CALL_STORE_SID_LEN, CALL_STORE_SID_LEN);
+    }
+
+    CallStoreBlock block = { pOrder[0].start, pOrder[rows - 1].start, pStore->dataSize, rows, 0 };
+
+    // The block must be on disk before the index entry that makes it visible,
+    // or a power loss could leave an entry pointing at unwritten rows
+
+    bool bWritten = pwrite(pStore->dataFD,  pBlock, blockBytes,   pStore->dataSize)  == (ssize_t) blockBytes &&
+                    fdatasync(pStore->dataFD) == 0 &&
+                    pwrite(pStore->indexFD, &block, sizeof(block), pStore->indexSize) == sizeof(block);
+
+    if (bWritten)
+    {
+        pStore->dataSize  += blockBytes;
+        pStore->indexSize += sizeof(block);
+        pStore->blocks++;
+    }
+    else
+    {
+        fprintf(stderr, "Failure writing %u calls to %s: %s\n", rows, pStore->pDataPath, strerror(errno));
+    }
+
+    free(pBlock);
+    free(pOrder);
+
+    return bWritten;
+}
+
+void CallStoreClose(CallStore *pStore)
+{
+    if (!pStore)
+    {
+        return;
+    }
+
+    if (pStore->dataFD >= 0 && pStore->indexFD >= 0)
+    {
+        CallStoreFlush(pStore);
+    }
+
+    if (pStore->dataFD >= 0)
+    {
+        close(pStore->dataFD);
+    }
+
+    if (pStore->indexFD >= 0)
+    {
+        close(pStore->indexFD);
+    }
+
+    FreeString(&pStore->pDataPath);
+    FreeString(&pStore->pIndexPath);
+
+    free(pStore->pStarts);
+    free(pStore->pKeys);
+    free(pStore->pDurations);
+    free(pStore->pDays);
+    free(pStore->pSIDs);
+
+    free(pStore);
+}
+
+static char *MapFile(const char *pPath, size_t *pSize)
+{
+    int fd = open(pPath, O_RDONLY);
+
+    struct stat fileStat;
+
+    if (fd < 0 || fstat(fd, &fileStat) != 0 || fileStat.st_size < (off_t) sizeof(CallStoreHeader))
+    {
+        fprintf(stderr, "No call store at %s\n", pPath);
+
+        if (fd >= 0)
+        {
+            close(fd);
+        }
+
+        return NULL;
+    }
+
+    void *pMap = mmap(NULL, fileStat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+    close(fd);
+
+    if (pMap == MAP_FAILED)
+    {
+        fprintf(stderr, "Failure mapping %s: %s\n", pPath, strerror(errno));
+        return NULL;
+    }
+
+    *pSize = fileStat.st_size;
+
+    return (char *) pMap;
+}
+
+bool CallStoreQuery(const char *pDirectory, const char *pAccount, time_t fromTime, time_t toTime, KeyTable *pKeyMap)
+{
+    char   *pDataPath, *pIndexPath;
+    size_t dataSize = 0, indexSize = 0;
+
+    asprintf(&pDataPath,  "%s/%s.col", pDirectory, pAccount);
+    asprintf(&pIndexPath, "%s/%s.idx", pDirectory, pAccount);
+
+    char *pData  = MapFile(pDataPath,  &dataSize);
+    char *pIndex = pData ? MapFile(pIndexPath, &indexSize) : NULL;
+
+    bool bValid = pIndex && ValidHeader((const CallStoreHeader *) pData) && ValidHeader((const CallStoreHeader *) pIndex);
+
+    if (pIndex && !bValid)
+    {
+        fprintf(stderr, "%s is not a call store this version can read\n", pDataPath);
+    }
+
+    long calls = 0, duplicates = 0, blocks = 0, blocksRead = 0;
+
+    GHashTable *pSeen = g_hash_table_new_full(g_str_hash, g_str_equal, free, NULL);
+
+    uint64_t dataEnd = sizeof(CallStoreHeader);
+
+    for (size_t offset=sizeof(CallStoreHeader); bValid && offset + sizeof(CallStoreBlock) <= indexSize; offset += sizeof(CallStoreBlock))
+    {
+        CallStoreBlock block;
+
+        memcpy(&block, pIndex + offset, sizeof(block));
+
+        if (block.offset != dataEnd || block.rows == 0 || block.rows > CALL_STORE_BLOCK_ROWS || block.offset + BlockBytes(block.rows) > dataSize)
+        {
+            break;
+        }
+
+        dataEnd += BlockBytes(block.rows);
+        blocks++;
+
+        if (block.lastStart < fromTime || block.firstStart >= toTime)
+        {
+            continue;
+        }
+
+        blocksRead++;
+
+        BlockColumns columns = Columns(pData + block.offset, block.rows);
+
+        // Rows are sorted on the start time, the first in range is found by bisection
+
+        uint32_t low = 0, high = block.rows;
+
+        while (low < high)
+        {
+            uint32_t middle = low + (high - low) / 2;
+
+            if (columns.pStarts[middle] < fromTime)
+            {
+                low = middle + 1;
+            }
+            else
+            {
+                high = middle;
+            }
+        }
+
+        for (uint32_t row=low; row<block.rows && columns.pStarts[row] < toTime; row++)
+        {
+            char sid[CALL_STORE_SID_LEN + 1];
+
+            memcpy(sid, columns.pSIDs + (size_t) row * CALL_STORE_SID_LEN, CALL_STORE_SID_LEN);
+
+            sid[CALL_STORE_SID_LEN] = 0;
+
+            if (!g_hash_table_add(pSeen, strdup(sid)))
+            {
+                duplicates++;
+                continue;
+            }
+
+            KeyTableAdd(pKeyMap, columns.pKeys[row], columns.pDays[row]);
+
+            calls++;
+        }
+    }
+
+    if (bValid)
+    {
+        fprintf(stderr, "Query      : %s %ld calls, %ld of %ld blocks read, %ld duplicates\n", pAccount, calls, blocksRead, blocks, duplicates);
+    }
+
+    g_hash_table_destroy(pSeen);
+
+    if (pData)
+    {
+        munmap(pData, dataSize);
+    }
+
+    if (pIndex)
+    {
+        munmap(pIndex, indexSize);
+    }
+
+    free(pDataPath);
+    free(pIndexPath);
+
+    return bValid;
+}
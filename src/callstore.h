@@ -0,0 +1,72 @@
+#ifndef CALLSTORE_H
+#define CALLSTORE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "keytable.h"
+
+#define CALL_STORE_MAGIC      0x53434143
+#define CALL_STORE_VERSION    1
+#define CALL_STORE_SID_LEN    34
+#define CALL_STORE_BLOCK_ROWS 4096
+
+// Every counted call of an account, kept in <directory>/<account>.col as
+// append only blocks of up to CALL_STORE_BLOCK_ROWS rows. A block is stored
+// column by column (start times, keys, durations, days, SIDs) sorted on the
+// start time. <account>.idx holds the start time range of every block, so a
+// query only touches the blocks overlapping its dates. A block is synced to
+// disk before its index entry is written, anything past the last indexed
+// block is dropped when the store is next opened.
+
+typedef struct
+{
+    uint32_t magic, version;
+} CallStoreHeader;
+
+typedef struct
+{
+    int64_t  firstStart, lastStart;
+    uint64_t offset;
+    uint32_t rows, reserved;
+} CallStoreBlock;
+
+typedef struct
+{
+    char     *pDataPath, *pIndexPath;
+    int      dataFD, indexFD;
+    uint64_t dataSize, indexSize;
+
+    // Rows waiting for the next block
+
+    int64_t  *pStarts;
+    int32_t  *pKeys, *pDurations;
+    uint8_t  *pDays;
+    char     *pSIDs;
+    uint32_t rows;
+
+    long     appended, blocks;
+} CallStore;
+
+CallStore *CallStoreOpen(const char *pDirectory, const char *pAccount);
+
+// Only buffers the row, a full block is written out
+
+bool       CallStoreAppend(CallStore *pStore, const char *pSID, time_t startTime, int day, int key, int duration);
+
+// Writes out the rows buffered so far as a block
+
+bool       CallStoreFlush(CallStore *pStore);
+
+// Flushes then closes, NULL is ignored
+
+void       CallStoreClose(CallStore *pStore);
+
+// Counts every call stored for pAccount that started in [fromTime, toTime)
+// into pKeyMap, reading the files through read only mappings. A call stored
+// more than once is counted once.
+
+bool       CallStoreQuery(const char *pDirectory, const char *pAccount, time_t fromTime, time_t toTime, KeyTable *pKeyMap);
+
+#endif
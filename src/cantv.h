@@ -0,0 +1,31 @@
+#ifndef CANTV_H
+#define CANTV_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "matcher.h"
+
+typedef struct
+{
+    const char *pStartDate, *pEndDate, *pAccount, *pAPIKey, *pEmailFrom, *pEmailTo, *pEmailFromName, *pEmailPassword, *pCacheDir, *pCheckpointPath, *pDumpPath, *pBaseURL, *pMetricsPath, *pSummaryPath, *pReplayPath, *pAccountsPath, *pStorePath;
+    int        eventsInFlight, eventsQueueDepth, listDepth, listShards, requestRate, cacheMB, cacheEntries, dumpMB, parseWorkers, servePort, serveInterval, mailEvery, memoryMB;
+    bool       bDumpCompress, bMailCompress, bQuery;
+    const char *pMarkers[MATCHER_MAX_PAIRS];
+    int        markerCount;
+} CmdLineArgs;
+
+extern CmdLineArgs g_cmdArgs;
+
+struct string
+{
+    char   *pCharData;
+    size_t dataLen;
+};
+
+int    asprintf(char **str, const char* fmt, ...);
+void   FreeString(char **pString);
+void   InitResponseString(struct string *s);
+size_t ResponseWrite(void *ptr, size_t size, size_t nmemb, struct string *s);
+
+#endif
@@ -0,0 +1,626 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <jansson.h>
+#include <glib.h>
+
+#include "cantv.h"
+#include "checkpoint.h"
+
+#define CHECKPOINT_VERSION 1
+
+time_t ParseCallTime(const char *pStart)
+{
+    struct tm callTime;
+
+    memset(&callTime, 0, sizeof(callTime));
+
+    if (!strptime(pStart, "%a, %d %b %Y %H:%M:%S", &callTime))
+    {
+        return 0;
+    }
+
+    return timegm(&callTime);
+}
+
+static bool IsSpillable(const char *pSID)
+{
+    return strlen(pSID) == CHECKPOINT_SID_LEN;
+}
+
+static gboolean RemoveSpillable(gpointer pKey, gpointer pValue, gpointer pUserData)
+{
+    return IsSpillable((const char *) pKey);
+}
+
+static int CompareSIDs(const void *pLeft, const void *pRight)
+{
+    return strcmp(*(const char **) pLeft, *(const char **) pRight);
+}
+
+// Binary search of a sorted SID file, a read per probe
+
+static bool RunContains(int runFD, long runSIDs, const char *pSID)
+{
+    long low  = 0;
+    long high = runSIDs;
+
+    char sid[CHECKPOINT_SID_LEN];
+
+    while (low < high)
+    {
+        long middle = low + (high - low) / 2;
+
+        if (pread(runFD, sid, CHECKPOINT_SID_LEN, (off_t) middle * CHECKPOINT_SID_LEN) != CHECKPOINT_SID_LEN)
+        {
+            return false;
+        }
+
+        int order = memcmp(sid, pSID, CHECKPOINT_SID_LEN);
+
+        if (order == 0)
+        {
+            return true;
+        }
+
+        if (order < 0)
+        {
+            low = middle + 1;
+        }
+        else
+        {
+            high = middle;
+        }
+    }
+
+    return false;
+}
+
+// A stream of its own over a SID file, the descriptor itself is only ever
+// used with pread
+
+static FILE *OpenRun(int runFD, const char *pMode)
+{
+    int copyFD = runFD >= 0 ? dup(runFD) : -1;
+
+    FILE *pRun = copyFD >= 0 ? fdopen(copyFD, pMode) : NULL;
+
+    if (!pRun && copyFD >= 0)
+    {
+        close(copyFD);
+    }
+
+    if (pRun)
+    {
+        rewind(pRun);
+    }
+
+    return pRun;
+}
+
+typedef struct
+{
+    FILE *pFile;
+    char sid[CHECKPOINT_SID_LEN];
+    bool bValid;
+} RunReader;
+
+static void RunNext(RunReader *pRun)
+{
+    pRun->bValid = pRun->pFile && fread(pRun->sid, 1, CHECKPOINT_SID_LEN, pRun->pFile) == CHECKPOINT_SID_LEN;
+}
+
+// Writes the spillable SIDs in memory merged with the SID files on firstFD and
+// secondFD to pOut, sorted and without duplicates. Returns how many were
+// written, -1 on failure. Memory is left as it was.
+
+static long MergeSIDs(Checkpoint *pCheckpoint, int firstFD, int secondFD, FILE *pOut)
+{
+    guint memorySIDs;
+
+    const char **ppSIDs = (const char **) g_hash_table_get_keys_as_array(pCheckpoint->pSIDs, &memorySIDs);
+
+    guint spillable = 0;
+
+    for (guint index=0; index<memorySIDs; index++)
+    {
+        if (IsSpillable(ppSIDs[index]))
+        {
+            ppSIDs[spillable++] = ppSIDs[index];
+        }
+    }
+
+    qsort(ppSIDs, spillable, sizeof(const char *), CompareSIDs);
+
+    RunReader runs[2] = { { OpenRun(firstFD, "rb") }, { OpenRun(secondFD, "rb") } };
+
+    RunNext(&runs[0]);
+    RunNext(&runs[1]);
+
+    char  last[CHECKPOINT_SID_LEN];
+    long  written = 0;
+    guint next    = 0;
+    bool  bOK     = true;
+
+    while (bOK)
+    {
+        const char *pSmallest = next < spillable ? ppSIDs[next] : NULL;
+        RunReader  *pSource   = NULL;
+
+        for (int run=0; run<2; run++)
+        {
+            if (runs[run].bValid && (!pSmallest || memcmp(runs[run].sid, pSmallest, CHECKPOINT_SID_LEN) < 0))
+            {
+                pSmallest = runs[run].sid;
+                pSource   = &runs[run];
+            }
+        }
+
+        if (!pSmallest)
+        {
+            break;
+        }
+
+        if (written == 0 || memcmp(last, pSmallest, CHECKPOINT_SID_LEN) != 0)
+        {
+            bOK = fwrite(pSmallest, 1, CHECKPOINT_SID_LEN, pOut) == CHECKPOINT_SID_LEN;
+
+            memcpy(last, pSmallest, CHECKPOINT_SID_LEN);
+            written++;
+        }
+
+        if (pSource)
+        {
+            RunNext(pSource);
+        }
+        else
+        {
+            next++;
+        }
+    }
+
+    for (int run=0; run<2; run++)
+    {
+        if (runs[run].pFile)
+        {
+            bOK = bOK && !ferror(runs[run].pFile);
+
+            fclose(runs[run].pFile);
+        }
+    }
+
+    g_free(ppSIDs);
+
+    return bOK ? written : -1;
+}
+
+// Spill files live next to the checkpoint, or in the temp directory for one
+// kept in memory, and are unlinked as soon as they're created
+
+static int CreateSpill(Checkpoint *pCheckpoint)
+{
+    char *pTemplate;
+
+    if (pCheckpoint->pPath)
+    {
+        asprintf(&pTemplate, "%s.spill.XXXXXX", pCheckpoint->pPath);
+    }
+    else
+    {
+        asprintf(&pTemplate, "%s/cantv-%s.spill.XXXXXX", g_get_tmp_dir(), pCheckpoint->pAccount);
+    }
+
+    int spillFD = mkstemp(pTemplate);
+
+    if (spillFD >= 0)
+    {
+        unlink(pTemplate);
+    }
+    else
+    {
+        fprintf(stderr, "Failure creating spill file %s\n", pTemplate);
+    }
+
+    free(pTemplate);
+
+    return spillFD;
+}
+
+Checkpoint *CheckpointLoad(const char *pPath, const char *pAccount, const char *pStartDate, KeyTable *pKeyMap)
+{
+    Checkpoint *pCheckpoint = calloc(1, sizeof(Checkpoint));
+
+    pCheckpoint->pPath      = pPath ? strdup(pPath) : NULL;
+    pCheckpoint->pAccount   = strdup(pAccount);
+    pCheckpoint->pStartDate = strdup(pStartDate);
+    pCheckpoint->pSIDs      = g_hash_table_new_full(g_str_hash, g_str_equal, free, NULL);
+    pCheckpoint->baseFD     = -1;
+    pCheckpoint->spillFD    = -1;
+
+    if (!pPath)
+    {
+        return pCheckpoint;
+    }
+
+    json_error_t err;
+
+    json_t *pState = json_load_file(pPath, 0, &err);
+
+    if (!pState)
+    {
+        fprintf(stderr, "No checkpoint loaded from %s, starting fresh\n", pPath);
+
+        return pCheckpoint;
+    }
+
+    const char *pStateAccount = json_string_value(json_object_get(pState, "account"));
+    const char *pStateStart   = json_string_value(json_object_get(pState, "start_date"));
+
+    if (json_integer_value(json_object_get(pState, "version")) != CHECKPOINT_VERSION ||
+        !pStateAccount || strcmp(pStateAccount, pAccount) != 0 ||
+        !pStateStart   || strcmp(pStateStart,   pStartDate) != 0)
+    {
+        fprintf(stderr, "Checkpoint %s is for a different account or window, starting fresh\n", pPath);
+
+        json_decref(pState);
+        return pCheckpoint;
+    }
+
+    const char *pSIDsPath = json_string_value(json_object_get(pState, "sids_file"));
+
+    if (pSIDsPath)
+    {
+        pCheckpoint->baseFD = open(pSIDsPath, O_RDONLY);
+
+        if (pCheckpoint->baseFD < 0)
+        {
+            fprintf(stderr, "Checkpoint %s refers to missing %s, starting fresh\n", pPath, pSIDsPath);
+
+            json_decref(pState);
+            return pCheckpoint;
+        }
+
+        pCheckpoint->pBasePath  = strdup(pSIDsPath);
+        pCheckpoint->baseSIDs   = lseek(pCheckpoint->baseFD, 0, SEEK_END) / CHECKPOINT_SID_LEN;
+        pCheckpoint->generation = (long) json_integer_value(json_object_get(pState, "sids_generation"));
+    }
+
+    pCheckpoint->lastStartTime = (time_t) json_integer_value(json_object_get(pState, "last_start_time"));
+
+    const char *pKey;
+    json_t     *pCounts;
+
+    json_object_foreach(json_object_get(pState, "counts"), pKey, pCounts)
+    {
+        int *pCount = KeyTableRow(pKeyMap, atoi(pKey));
+
+        if (!pCount)
+        {
+            continue;
+        }
+
+        for (int index=0; index<KEY_TABLE_COLUMNS && index<json_array_size(pCounts); index++)
+        {
+            pCount[index] += (int) json_integer_value(json_array_get(pCounts, index));
+        }
+    }
+
+    json_t *pSIDs = json_object_get(pState, "sids");
+
+    for (size_t index=0; index<json_array_size(pSIDs); index++)
+    {
+        const char *pSID = json_string_value(json_array_get(pSIDs, index));
+
+        if (pSID)
+        {
+            g_hash_table_add(pCheckpoint->pSIDs, strdup(pSID));
+        }
+    }
+
+    fprintf(stderr, "Checkpoint %s: %ld calls already counted\n", pPath, (long) g_hash_table_size(pCheckpoint->pSIDs) + pCheckpoint->baseSIDs);
+
+    json_decref(pState);
+
+    return pCheckpoint;
+}
+
+static void AddCounts(int key, const int *pValues, void *pUserData)
+{
+    json_t *pCounts = json_array();
+
+    for (int index=0; index<KEY_TABLE_COLUMNS; index++)
+    {
+        json_array_append_new(pCounts, json_integer(pValues[index]));
+    }
+
+    char pKey[16];
+
+    snprintf(pKey, sizeof(pKey), "%d", key);
+
+    json_object_set_new((json_t *) pUserData, pKey, pCounts);
+}
+
+typedef struct
+{
+    json_t *pSIDs;
+    bool   bSkipSpillable;
+} AddSIDData;
+
+static void AddSID(gpointer pKey, gpointer pValue, gpointer pUserData)
+{
+    AddSIDData *pData = (AddSIDData *) pUserData;
+
+    if (!pData->bSkipSpillable || !IsSpillable((const char *) pKey))
+    {
+        json_array_append_new(pData->pSIDs, json_string((const char *) pKey));
+    }
+}
+
+// Merges everything spilled or in memory into the next generation's SID file
+
+static char *WriteSIDsFile(Checkpoint *pCheckpoint)
+{
+    char *pSIDsPath;
+
+    asprintf(&pSIDsPath, "%s.sids.%ld", pCheckpoint->pPath, pCheckpoint->generation + 1);
+
+    FILE *pOut = fopen(pSIDsPath, "wb");
+
+    long written = pOut ? MergeSIDs(pCheckpoint, pCheckpoint->spillFD, pCheckpoint->baseFD, pOut) : -1;
+
+    if (pOut && fclose(pOut) != 0)
+    {
+        written = -1;
+    }
+
+    if (written < 0)
+    {
+        fprintf(stderr, "Failure writing checkpoint SIDs %s\n", pSIDsPath);
+
+        unlink(pSIDsPath);
+        FreeString(&pSIDsPath);
+    }
+
+    return pSIDsPath;
+}
+
+// The checkpoint now refers to pSIDsPath, so the spill and the previous
+// generation are dropped along with the spillable SIDs in memory
+
+static void AdoptSIDsFile(Checkpoint *pCheckpoint, char *pSIDsPath)
+{
+    if (pCheckpoint->baseFD >= 0)
+    {
+        close(pCheckpoint->baseFD);
+        unlink(pCheckpoint->pBasePath);
+    }
+
+    if (pCheckpoint->spillFD >= 0)
+    {
+        close(pCheckpoint->spillFD);
+    }
+
+    FreeString(&pCheckpoint->pBasePath);
+
+    g_hash_table_foreach_remove(pCheckpoint->pSIDs, RemoveSpillable, NULL);
+
+    pCheckpoint->pBasePath = pSIDsPath;
+    pCheckpoint->baseFD    = open(pSIDsPath, O_RDONLY);
+    pCheckpoint->baseSIDs  = pCheckpoint->baseFD >= 0 ? lseek(pCheckpoint->baseFD, 0, SEEK_END) / CHECKPOINT_SID_LEN : 0;
+    pCheckpoint->spillFD   = -1;
+    pCheckpoint->spillSIDs = 0;
+
+    pCheckpoint->generation++;
+}
+
+bool CheckpointSave(Checkpoint *pCheckpoint, KeyTable *pKeyMap)
+{
+    if (!pCheckpoint->pPath)
+    {
+        return true;
+    }
+
+    char *pSIDsPath = NULL;
+
+    if (pCheckpoint->baseFD >= 0 || pCheckpoint->spillFD >= 0)
+    {
+        pSIDsPath = WriteSIDsFile(pCheckpoint);
+
+        if (!pSIDsPath)
+        {
+            return false;
+        }
+    }
+
+    json_t *pState  = json_object();
+    json_t *pCounts = json_object();
+    json_t *pSIDs   = json_array();
+
+    AddSIDData sidData = { pSIDs, pSIDsPath != NULL };
+
+    KeyTableForEach(pKeyMap, AddCounts, pCounts);
+    g_hash_table_foreach(pCheckpoint->pSIDs, AddSID, &sidData);
+
+    json_object_set_new(pState, "version",         json_integer(CHECKPOINT_VERSION));
+    json_object_set_new(pState, "account",         json_string(pCheckpoint->pAccount));
+    json_object_set_new(pState, "start_date",      json_string(pCheckpoint->pStartDate));
+    json_object_set_new(pState, "last_start_time", json_integer(pCheckpoint->lastStartTime));
+    json_object_set_new(pState, "counts",          pCounts);
+    json_object_set_new(pState, "sids",            pSIDs);
+
+    if (pSIDsPath)
+    {
+        json_object_set_new(pState, "sids_file",       json_string(pSIDsPath));
+        json_object_set_new(pState, "sids_generation", json_integer(pCheckpoint->generation + 1));
+    }
+
+    char *pTempPath;
+
+    asprintf(&pTempPath, "%s.tmp", pCheckpoint->pPath);
+
+    bool bSaved = json_dump_file(pState, pTempPath, JSON_COMPACT) == 0 && rename(pTempPath, pCheckpoint->pPath) == 0;
+
+    if (!bSaved)
+    {
+        fprintf(stderr, "Failure saving checkpoint %s\n", pCheckpoint->pPath);
+    }
+
+    if (pSIDsPath && bSaved)
+    {
+        AdoptSIDsFile(pCheckpoint, pSIDsPath);
+    }
+    else if (pSIDsPath)
+    {
+        unlink(pSIDsPath);
+        free(pSIDsPath);
+    }
+
+    free(pTempPath);
+
+    json_decref(pState);
+
+    return bSaved;
+}
+
+void CheckpointFree(Checkpoint *pCheckpoint)
+{
+    if (pCheckpoint)
+    {
+        g_hash_table_destroy(pCheckpoint->pSIDs);
+
+        if (pCheckpoint->baseFD >= 0)
+        {
+            close(pCheckpoint->baseFD);
+        }
+
+        if (pCheckpoint->spillFD >= 0)
+        {
+            close(pCheckpoint->spillFD);
+        }
+
+        FreeString(&pCheckpoint->pBasePath);
+        FreeString(&pCheckpoint->pPath);
+        FreeString(&pCheckpoint->pAccount);
+        FreeString(&pCheckpoint->pStartDate);
+
+        free(pCheckpoint);
+    }
+}
+
+bool CheckpointSeen(Checkpoint *pCheckpoint, const char *pSID)
+{
+    bool bSpilled = IsSpillable(pSID) && (RunContains(pCheckpoint->spillFD, pCheckpoint->spillSIDs, pSID) ||
+                                          RunContains(pCheckpoint->baseFD,  pCheckpoint->baseSIDs,  pSID));
+
+    if (bSpilled || g_hash_table_contains(pCheckpoint->pSIDs, pSID))
+    {
+        pCheckpoint->skipped++;
+
+        return true;
+    }
+
+    return false;
+}
+
+void CheckpointMark(Checkpoint *pCheckpoint, const char *pSID, time_t startTime)
+{
+    if (g_hash_table_add(pCheckpoint->pSIDs, strdup(pSID)))
+    {
+        pCheckpoint->marked++;
+    }
+
+    if (startTime > pCheckpoint->newestStartTime)
+    {
+        pCheckpoint->newestStartTime = startTime;
+    }
+}
+
+void CheckpointFail(Checkpoint *pCheckpoint, time_t startTime)
+{
+    if (!pCheckpoint->bFailed || startTime < pCheckpoint->failedStartTime)
+    {
+        pCheckpoint->failedStartTime = startTime;
+    }
+
+    pCheckpoint->bFailed = true;
+}
+
+void CheckpointAdvance(Checkpoint *pCheckpoint)
+{
+    time_t resumeTime = pCheckpoint->newestStartTime;
+
+    if (pCheckpoint->bFailed && pCheckpoint->failedStartTime < resumeTime)
+    {
+        resumeTime = pCheckpoint->failedStartTime;
+    }
+
+    if (resumeTime > pCheckpoint->lastStartTime)
+    {
+        pCheckpoint->lastStartTime = resumeTime;
+    }
+
+    pCheckpoint->newestStartTime = 0;
+    pCheckpoint->failedStartTime = 0;
+    pCheckpoint->bFailed         = false;
+}
+
+bool CheckpointSpill(Checkpoint *pCheckpoint)
+{
+    int spillFD = CreateSpill(pCheckpoint);
+
+    if (spillFD < 0)
+    {
+        return false;
+    }
+
+    FILE *pOut = OpenRun(spillFD, "wb");
+
+    long written = pOut ? MergeSIDs(pCheckpoint, pCheckpoint->spillFD, -1, pOut) : -1;
+
+    if (pOut && fclose(pOut) != 0)
+    {
+        written = -1;
+    }
+
+    if (written < 0)
+    {
+        fprintf(stderr, "Failure spilling checkpoint SIDs for %s\n", pCheckpoint->pAccount);
+
+        close(spillFD);
+        return false;
+    }
+
+    if (pCheckpoint->spillFD >= 0)
+    {
+        close(pCheckpoint->spillFD);
+    }
+
+    g_hash_table_foreach_remove(pCheckpoint->pSIDs, RemoveSpillable, NULL);
+
+    pCheckpoint->spillFD   = spillFD;
+    pCheckpoint->spillSIDs = written;
+
+    return true;
+}
+
+void CheckpointResumeDate(Checkpoint *pCheckpoint, const char *pStartDate, char *pDate, int dateLength)
+{
+    snprintf(pDate, dateLength, "%s", pStartDate);
+
+    if (pCheckpoint->lastStartTime > 0)
+    {
+        char lastDate[32];
+
+        struct tm lastTime = *gmtime(&pCheckpoint->lastStartTime);
+
+        strftime(lastDate, sizeof(lastDate), "%Y-%m-%d", &lastTime);
+
+        if (strcmp(lastDate, pDate) > 0)
+        {
+            snprintf(pDate, dateLength, "%s", lastDate);
+        }
+    }
+}
@@ -0,0 +1,63 @@
+#ifndef CHECKPOINT_H
+#define CHECKPOINT_H
+
+#include <stdbool.h>
+#include <time.h>
+#include <glib.h>
+
+#include "keytable.h"
+
+#define CHECKPOINT_SID_LEN 34
+
+// Aggregation state carried between runs over the same window: the per key
+// counts, every call SID already counted and the start time to resume from.
+// The resume point only moves up to calls whose whole day was counted.
+// SIDs can be moved out of memory into sorted files of CHECKPOINT_SID_LEN
+// wide records: the base file the saved checkpoint refers to and a scratch
+// spill file for the current run.
+
+typedef struct
+{
+    char       *pPath, *pAccount, *pStartDate, *pBasePath;
+    GHashTable *pSIDs;
+    int        baseFD, spillFD;
+    long       baseSIDs, spillSIDs, generation;
+    time_t     lastStartTime, newestStartTime, failedStartTime;
+    bool       bFailed;
+    long       skipped, marked;
+} Checkpoint;
+
+// Counts stored in the checkpoint are merged into pKeyMap. A NULL pPath keeps
+// the checkpoint in memory only, nothing is loaded or saved. Once SIDs have
+// been spilled the save writes them all to <pPath>.sids.<generation> and the
+// checkpoint refers to that file instead of listing them.
+
+Checkpoint *CheckpointLoad(const char *pPath, const char *pAccount, const char *pStartDate, KeyTable *pKeyMap);
+bool        CheckpointSave(Checkpoint *pCheckpoint, KeyTable *pKeyMap);
+void        CheckpointFree(Checkpoint *pCheckpoint);
+
+bool        CheckpointSeen(Checkpoint *pCheckpoint, const char *pSID);
+void        CheckpointMark(Checkpoint *pCheckpoint, const char *pSID, time_t startTime);
+
+// Records a call that went uncounted, or the start of a listing that didn't
+// finish, the resume point stays at or before the oldest one
+
+void        CheckpointFail(Checkpoint *pCheckpoint, time_t startTime);
+
+// Moves the resume point to the newest call marked since the last advance,
+// held back by any failure recorded in between
+
+void        CheckpointAdvance(Checkpoint *pCheckpoint);
+
+// Moves the SIDs held in memory to the spill file, where CheckpointSeen still
+// finds them. SIDs of an unexpected length stay in memory.
+
+bool        CheckpointSpill(Checkpoint *pCheckpoint);
+
+// Date to list from, the later of pStartDate and the day of the resume point
+
+void        CheckpointResumeDate(Checkpoint *pCheckpoint, const char *pStartDate, char *pDate, int dateLength);
+
+time_t      ParseCallTime(const char *pStart);
+
+#endif
@@ -0,0 +1,255 @@
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <zlib.h>
+
+#include "cantv.h"
+#include "dump.h"
+
+#define DUMP_CHUNK       4096
+#define DUMP_FLUSH_LINES 256
+
+DumpWriter *DumpOpen(const char *pPath, bool bCompress, uint64_t maxBytes)
+{
+    DumpWriter *pDump = calloc(1, sizeof(DumpWriter));
+
+    if (!pDump)
+    {
+        return NULL;
+    }
+
+    pDump->pPath    = strdup(pPath);
+    pDump->maxBytes = maxBytes;
+
+    if (bCompress)
+    {
+        pDump->pGZFile = gzopen(pPath, "wb6");
+    }
+    else
+    {
+        pDump->pFile = fopen(pPath, "wb");
+    }
+
+    if (!pDump->pFile && !pDump->pGZFile)
+    {
+        fprintf(stderr, "Failure opening dump file %s\n", pPath);
+
+        FreeString(&pDump->pPath);
+        free(pDump);
+        return NULL;
+    }
+
+    return pDump;
+}
+
+static bool WriteBytes(DumpWriter *pDump, const char *pData, size_t dataLen)
+{
+    if (pDump->pGZFile)
+    {
+        return gzwrite(pDump->pGZFile, pData, dataLen) == (int) dataLen;
+    }
+
+    return fwrite(pData, 1, dataLen, pDump->pFile) == dataLen;
+}
+
+// Newlines can only appear as whitespace in valid JSON, so they are blanked
+// rather than re-serialising the response to keep it on one line. The raw
+// response is wrapped verbatim as the value of "response".
+
+bool DumpWrite(DumpWriter *pDump, const char *pSID, time_t startTime, int day, const char *pJSON, size_t jsonLen)
+{
+    char prefix[160];
+
+    int prefixLen = snprintf(prefix, sizeof(prefix), "{\"sid\":\"%.64s\",\"start_time\":%lld,\"day\":%d,\"response\":", pSID, (long long) startTime, day);
+
+    size_t lineLen = prefixLen + jsonLen + 2;
+
+    if (pDump->maxBytes && pDump->bytesWritten + lineLen > pDump->maxBytes)
+    {
+        if (pDump->dropped++ == 0)
+        {
+            fprintf(stderr, "Dump %s reached its size limit, further responses are not dumped\n", pDump->pPath);
+        }
+
+        return false;
+    }
+
+    if (!WriteBytes(pDump, prefix, prefixLen))
+    {
+        fprintf(stderr, "Failure writing dump file %s\n", pDump->pPath);
+        return false;
+    }
+
+    char chunk[DUMP_CHUNK];
+
+    for (size_t offset=0; offset<jsonLen; offset+=DUMP_CHUNK)
+    {
+        size_t chunkLen = jsonLen - offset < DUMP_CHUNK ? jsonLen - offset : DUMP_CHUNK;
+
+        memcpy(chunk, pJSON + offset, chunkLen);
+
+        for (size_t index=0; index<chunkLen; index++)
+        {
+            if (chunk[index] == '\n' || chunk[index] == '\r')
+            {
+                chunk[index] = ' ';
+            }
+        }
+
+        if (!WriteBytes(pDump, chunk, chunkLen))
+        {
+            fprintf(stderr, "Failure writing dump file %s\n", pDump->pPath);
+            return false;
+        }
+    }
+
+    if (!WriteBytes(pDump, "}\n", 2))
+    {
+        return false;
+    }
+
+    pDump->bytesWritten += lineLen;
+    pDump->lines++;
+
+    // Plain dumps are flushed per line, gzip ones every DUMP_FLUSH_LINES so a
+    // crash loses at most that many responses without wrecking the ratio
+
+    if (pDump->pGZFile)
+    {
+        if (++pDump->unflushed >= DUMP_FLUSH_LINES)
+        {
+            gzflush(pDump->pGZFile, Z_SYNC_FLUSH);
+
+            pDump->unflushed = 0;
+        }
+    }
+    else
+    {
+        fflush(pDump->pFile);
+    }
+
+    return true;
+}
+
+void DumpClose(DumpWriter *pDump)
+{
+    if (!pDump)
+    {
+        return;
+    }
+
+    fprintf(stderr, "Dump       : %ld responses, %llu bytes to %s\n", pDump->lines, (unsigned long long) pDump->bytesWritten, pDump->pPath);
+
+    if (pDump->dropped)
+    {
+        fprintf(stderr, "Dump Drop  : %ld responses over the size limit\n", pDump->dropped);
+    }
+
+    if (pDump->pGZFile)
+    {
+        gzclose(pDump->pGZFile);
+    }
+
+    if (pDump->pFile)
+    {
+        fclose(pDump->pFile);
+    }
+
+    FreeString(&pDump->pPath);
+
+    free(pDump);
+}
+
+DumpReader *DumpReaderOpen(const char *pPath)
+{
+    DumpReader *pReader = calloc(1, sizeof(DumpReader));
+
+    if (!pReader)
+    {
+        return NULL;
+    }
+
+    pReader->pGZFile = gzopen(pPath, "rb");
+
+    if (!pReader->pGZFile)
+    {
+        fprintf(stderr, "Failure opening dump file %s\n", pPath);
+
+        free(pReader);
+        return NULL;
+    }
+
+    gzbuffer(pReader->pGZFile, 1 << 17);
+
+    return pReader;
+}
+
+const char *DumpReadLine(DumpReader *pReader, size_t *pLineLen)
+{
+    size_t lineLen = 0;
+
+    while (1)
+    {
+        if (pReader->bufferSize - lineLen < DUMP_CHUNK)
+        {
+            size_t bufferSize = pReader->bufferSize ? pReader->bufferSize * 2 : 4 * DUMP_CHUNK;
+            char   *pBuffer   = realloc(pReader->pBuffer, bufferSize);
+
+            if (!pBuffer)
+            {
+                fprintf(stderr, "Failure growing dump line buffer to %zu bytes\n", bufferSize);
+
+                pReader->bError = true;
+                return NULL;
+            }
+
+            pReader->pBuffer    = pBuffer;
+            pReader->bufferSize = bufferSize;
+        }
+
+        if (!gzgets(pReader->pGZFile, pReader->pBuffer + lineLen, (int) (pReader->bufferSize - lineLen)))
+        {
+            int        errorCode;
+            const char *pError = gzerror(pReader->pGZFile, &errorCode);
+
+            if (errorCode != Z_OK)
+            {
+                fprintf(stderr, "Failure reading dump file, %s\n", errorCode == Z_ERRNO ? strerror(errno) : pError);
+
+                pReader->bError = true;
+                return NULL;
+            }
+
+            if (lineLen == 0)
+            {
+                return NULL;
+            }
+
+            break;
+        }
+
+        lineLen += strlen(pReader->pBuffer + lineLen);
+
+        if (lineLen > 0 && pReader->pBuffer[lineLen - 1] == '\n')
+        {
+            pReader->pBuffer[--lineLen] = '\0';
+            break;
+        }
+    }
+
+    *pLineLen = lineLen;
+
+    return pReader->pBuffer;
+}
+
+void DumpReaderClose(DumpReader *pReader)
+{
+    if (pReader)
+    {
+        gzclose(pReader->pGZFile);
+
+        free(pReader->pBuffer);
+        free(pReader);
+    }
+}
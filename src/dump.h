@@ -0,0 +1,47 @@
+#ifndef DUMP_H
+#define DUMP_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+#include <zlib.h>
+
+// Raw Events.json responses written as NDJSON, one line per response as it
+// arrives: {"sid":..,"start_time":..,"day":..,"response":<raw response>}.
+// maxBytes caps the uncompressed size, 0 for no limit.
+
+typedef struct
+{
+    char     *pPath;
+    FILE     *pFile;
+    gzFile   pGZFile;
+    uint64_t bytesWritten, maxBytes;
+    long     lines, dropped, unflushed;
+} DumpWriter;
+
+DumpWriter *DumpOpen(const char *pPath, bool bCompress, uint64_t maxBytes);
+bool        DumpWrite(DumpWriter *pDump, const char *pSID, time_t startTime, int day, const char *pJSON, size_t jsonLen);
+void        DumpClose(DumpWriter *pDump);
+
+// Reads a dump back a line at a time, plain or gzip
+
+typedef struct
+{
+    gzFile pGZFile;
+    char   *pBuffer;
+    size_t bufferSize;
+    bool   bError;
+} DumpReader;
+
+DumpReader *DumpReaderOpen(const char *pPath);
+
+// The line is valid until the next call, NULL at the end of the file or once
+// the file can't be read any further, when bError is set. A corrupt or
+// truncated gzip file ends in an error.
+
+const char *DumpReadLine(DumpReader *pReader, size_t *pLineLen);
+void        DumpReaderClose(DumpReader *pReader);
+
+#endif
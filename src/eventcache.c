@@ -0,0 +1,408 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "cantv.h"
+#include "eventcache.h"
+
+static uint64_t Checksum(const char *pData, size_t dataLen)
+{
+    uint64_t hash = 0xcbf29ce484222325ULL;
+
+    for (size_t index=0; index<dataLen; index++)
+    {
+        hash ^= (unsigned char) pData[index];
+        hash *= 0x100000001b3ULL;
+    }
+
+    return hash;
+}
+
+static uint32_t SlotCapacity(uint32_t maxEntries)
+{
+    uint32_t capacity = 1024;
+
+    while (capacity < maxEntries + maxEntries / 3)
+    {
+        capacity *= 2;
+    }
+
+    return capacity;
+}
+
+static EventCacheSlot *FindSlot(EventCacheSlot *pSlots, uint32_t capacity, const char *pSID)
+{
+    uint32_t mask = capacity - 1;
+    uint32_t slot = (uint32_t) Checksum(pSID, strlen(pSID)) & mask;
+
+    while (pSlots[slot].sid[0] && strcmp(pSlots[slot].sid, pSID) != 0)
+    {
+        slot = (slot + 1) & mask;
+    }
+
+    return &pSlots[slot];
+}
+
+static bool MapIndex(EventCache *pCache, uint32_t capacity)
+{
+    if (pCache->pHeader)
+    {
+        munmap(pCache->pHeader, pCache->mapSize);
+
+        pCache->pHeader = NULL;
+        pCache->pSlots  = NULL;
+    }
+
+    pCache->mapSize = sizeof(EventCacheHeader) + (size_t) capacity * sizeof(EventCacheSlot);
+
+    if (ftruncate(pCache->indexFD, pCache->mapSize) != 0)
+    {
+        fprintf(stderr, "Failure sizing %s: %s\n", pCache->pIndexPath, strerror(errno));
+        return false;
+    }
+
+    void *pMap = mmap(NULL, pCache->mapSize, PROT_READ | PROT_WRITE, MAP_SHARED, pCache->indexFD, 0);
+
+    if (pMap == MAP_FAILED)
+    {
+        fprintf(stderr, "Failure mapping %s: %s\n", pCache->pIndexPath, strerror(errno));
+        return false;
+    }
+
+    pCache->pHeader = (EventCacheHeader *) pMap;
+    pCache->pSlots  = (EventCacheSlot *) (pCache->pHeader + 1);
+
+    return true;
+}
+
+static bool ResetCache(EventCache *pCache, uint32_t capacity)
+{
+    if (ftruncate(pCache->dataFD, 0) != 0 || ftruncate(pCache->indexFD, 0) != 0 || !MapIndex(pCache, capacity))
+    {
+        return false;
+    }
+
+    pCache->pHeader->magic    = EVENT_CACHE_MAGIC;
+    pCache->pHeader->version  = EVENT_CACHE_VERSION;
+    pCache->pHeader->capacity = capacity;
+
+    return true;
+}
+
+static int CompareStampDescending(const void *pA, const void *pB)
+{
+    uint32_t a = (*(const EventCacheSlot **) pA)->stamp;
+    uint32_t b = (*(const EventCacheSlot **) pB)->stamp;
+
+    return a < b ? 1 : a > b ? -1 : 0;
+}
+
+// Rewrites events.dat keeping the most recently used entries that fit in the
+// given budget and rebuilds the index at the configured capacity
+
+static bool Compact(EventCache *pCache, uint64_t keepBytes, uint32_t keepEntries)
+{
+    uint32_t        oldCapacity = pCache->pHeader->capacity;
+    uint32_t        newCapacity = SlotCapacity(pCache->maxEntries);
+    uint32_t        liveCount   = 0;
+    EventCacheSlot  **ppLive    = malloc(sizeof(EventCacheSlot *) * (pCache->pHeader->count + 1));
+    EventCacheSlot  *pNewSlots  = calloc(newCapacity, sizeof(EventCacheSlot));
+    char            *pTempPath  = NULL;
+
+    asprintf(&pTempPath, "%s.tmp", pCache->pDataPath);
+
+    int tempFD = pTempPath ? open(pTempPath, O_RDWR | O_CREAT | O_TRUNC, 0644) : -1;
+
+    if (!ppLive || !pNewSlots || tempFD < 0)
+    {
+        fprintf(stderr, "Failure compacting event cache\n");
+
+        free(ppLive);
+        free(pNewSlots);
+        FreeString(&pTempPath);
+
+        if (tempFD >= 0)
+        {
+            close(tempFD);
+        }
+
+        return false;
+    }
+
+    for (uint32_t slot=0; slot<oldCapacity && liveCount<pCache->pHeader->count; slot++)
+    {
+        if (pCache->pSlots[slot].sid[0])
+        {
+            ppLive[liveCount++] = &pCache->pSlots[slot];
+        }
+    }
+
+    qsort(ppLive, liveCount, sizeof(EventCacheSlot *), CompareStampDescending);
+
+    uint64_t dataSize  = 0;
+    uint32_t kept      = 0;
+    char     *pBuffer  = NULL;
+    size_t   bufferLen = 0;
+
+    for (uint32_t index=0; index<liveCount; index++)
+    {
+        EventCacheSlot *pSlot = ppLive[index];
+
+        if (kept >= keepEntries || dataSize + pSlot->length > keepBytes)
+        {
+            pCache->evictions++;
+            continue;
+        }
+
+        if (pSlot->length > bufferLen)
+        {
+            char *pNewBuffer = realloc(pBuffer, pSlot->length);
+
+            if (!pNewBuffer)
+            {
+                pCache->evictions++;
+                continue;
+            }
+
+            pBuffer   = pNewBuffer;
+            bufferLen = pSlot->length;
+        }
+
+        if (pread(pCache->dataFD, pBuffer, pSlot->length, pSlot->offset) != (ssize_t) pSlot->length ||
+            pwrite(tempFD, pBuffer, pSlot->length, dataSize) != (ssize_t) pSlot->length)
+        {
+            pCache->evictions++;
+            continue;
+        }
+
+        EventCacheSlot *pNewSlot = FindSlot(pNewSlots, newCapacity, pSlot->sid);
+
+        *pNewSlot        = *pSlot;
+        pNewSlot->offset = dataSize;
+
+        dataSize += pSlot->length;
+        kept++;
+    }
+
+    free(pBuffer);
+    free(ppLive);
+
+    bool bOK = rename(pTempPath, pCache->pDataPath) == 0;
+
+    if (bOK)
+    {
+        close(pCache->dataFD);
+
+        pCache->dataFD = tempFD;
+
+        uint32_t stamp = pCache->pHeader->stamp;
+
+        bOK = MapIndex(pCache, newCapacity);
+
+        if (bOK)
+        {
+            memcpy(pCache->pSlots, pNewSlots, (size_t) newCapacity * sizeof(EventCacheSlot));
+
+            pCache->pHeader->magic    = EVENT_CACHE_MAGIC;
+            pCache->pHeader->version  = EVENT_CACHE_VERSION;
+            pCache->pHeader->capacity = newCapacity;
+            pCache->pHeader->count    = kept;
+            pCache->pHeader->dataSize = dataSize;
+            pCache->pHeader->stamp    = stamp;
+        }
+    }
+    else
+    {
+        fprintf(stderr, "Failure replacing %s: %s\n", pCache->pDataPath, strerror(errno));
+
+        close(tempFD);
+        unlink(pTempPath);
+    }
+
+    free(pNewSlots);
+    FreeString(&pTempPath);
+
+    return bOK;
+}
+
+EventCache *EventCacheOpen(const char *pDirectory, uint64_t maxBytes, uint32_t maxEntries)
+{
+    if (mkdir(pDirectory, 0755) != 0 && errno != EEXIST)
+    {
+        fprintf(stderr, "Failure creating cache directory %s: %s\n", pDirectory, strerror(errno));
+        return NULL;
+    }
+
+    EventCache *pCache = calloc(1, sizeof(EventCache));
+
+    if (!pCache)
+    {
+        return NULL;
+    }
+
+    pCache->maxBytes   = maxBytes;
+    pCache->maxEntries = maxEntries > 0 ? maxEntries : 1;
+    pCache->indexFD    = -1;
+    pCache->dataFD     = -1;
+
+    asprintf(&pCache->pIndexPath, "%s/events.idx", pDirectory);
+    asprintf(&pCache->pDataPath,  "%s/events.dat", pDirectory);
+
+    pCache->indexFD = open(pCache->pIndexPath, O_RDWR | O_CREAT, 0644);
+    pCache->dataFD  = open(pCache->pDataPath,  O_RDWR | O_CREAT, 0644);
+
+    struct stat indexStat, dataStat;
+
+    if (pCache->indexFD < 0 || pCache->dataFD < 0 || fstat(pCache->indexFD, &indexStat) != 0 || fstat(pCache->dataFD, &dataStat) != 0)
+    {
+        fprintf(stderr, "Failure opening event cache in %s: %s\n", pDirectory, strerror(errno));
+
+        EventCacheClose(pCache);
+        return NULL;
+    }
+
+    EventCacheHeader header;
+
+    bool bValid = indexStat.st_size >= (off_t) sizeof(EventCacheHeader) &&
+                  pread(pCache->indexFD, &header, sizeof(header), 0) == sizeof(header) &&
+                  header.magic   == EVENT_CACHE_MAGIC &&
+                  header.version == EVENT_CACHE_VERSION &&
+                  header.capacity >= 1024 && (header.capacity & (header.capacity - 1)) == 0 &&
+                  indexStat.st_size == (off_t) (sizeof(EventCacheHeader) + (size_t) header.capacity * sizeof(EventCacheSlot)) &&
+                  (uint64_t) dataStat.st_size >= header.dataSize;
+
+    if (bValid ? !MapIndex(pCache, header.capacity) : !ResetCache(pCache, SlotCapacity(pCache->maxEntries)))
+    {
+        EventCacheClose(pCache);
+        return NULL;
+    }
+
+    pCache->pHeader->stamp++;
+
+    if (pCache->pHeader->capacity != SlotCapacity(pCache->maxEntries) ||
+        pCache->pHeader->count    >  pCache->maxEntries ||
+        pCache->pHeader->dataSize >  pCache->maxBytes)
+    {
+        Compact(pCache, pCache->maxBytes, pCache->maxEntries);
+    }
+
+    return pCache;
+}
+
+void EventCacheClose(EventCache *pCache)
+{
+    if (!pCache)
+    {
+        return;
+    }
+
+    if (pCache->pHeader)
+    {
+        msync(pCache->pHeader, pCache->mapSize, MS_SYNC);
+        munmap(pCache->pHeader, pCache->mapSize);
+    }
+
+    if (pCache->indexFD >= 0)
+    {
+        close(pCache->indexFD);
+    }
+
+    if (pCache->dataFD >= 0)
+    {
+        close(pCache->dataFD);
+    }
+
+    FreeString(&pCache->pIndexPath);
+    FreeString(&pCache->pDataPath);
+
+    free(pCache);
+}
+
+char *EventCacheLookup(EventCache *pCache, const char *pSID, Arena *pArena)
+{
+    if (strlen(pSID) >= EVENT_CACHE_SID_LEN)
+    {
+        pCache->misses++;
+        return NULL;
+    }
+
+    EventCacheSlot *pSlot = FindSlot(pCache->pSlots, pCache->pHeader->capacity, pSID);
+
+    if (!pSlot->sid[0])
+    {
+        pCache->misses++;
+        return NULL;
+    }
+
+    char *pBody = ArenaAlloc(pArena, pSlot->length + 1);
+
+    if (!pBody || pread(pCache->dataFD, pBody, pSlot->length, pSlot->offset) != (ssize_t) pSlot->length ||
+        Checksum(pBody, pSlot->length) != pSlot->checksum)
+    {
+        pCache->misses++;
+        return NULL;
+    }
+
+    pBody[pSlot->length] = 0;
+    pSlot->stamp = pCache->pHeader->stamp;
+
+    pCache->hits++;
+
+    return pBody;
+}
+
+bool EventCacheStore(EventCache *pCache, const char *pSID, const char *pBody, size_t bodyLen)
+{
+    if (strlen(pSID) >= EVENT_CACHE_SID_LEN || bodyLen > pCache->maxBytes / 4 || bodyLen > UINT32_MAX)
+    {
+        return false;
+    }
+
+    if (pCache->pHeader->count + 1 > pCache->maxEntries || pCache->pHeader->dataSize + bodyLen > pCache->maxBytes)
+    {
+        if (!Compact(pCache, pCache->maxBytes / 4 * 3, pCache->maxEntries / 4 * 3))
+        {
+            return false;
+        }
+    }
+
+    EventCacheSlot *pSlot  = FindSlot(pCache->pSlots, pCache->pHeader->capacity, pSID);
+    uint64_t       offset  = pCache->pHeader->dataSize;
+
+    if (pwrite(pCache->dataFD, pBody, bodyLen, offset) != (ssize_t) bodyLen)
+    {
+        fprintf(stderr, "Failure writing %s: %s\n", pCache->pDataPath, strerror(errno));
+        return false;
+    }
+
+    if (!pSlot->sid[0])
+    {
+        pCache->pHeader->count++;
+    }
+
+    pSlot->offset   = offset;
+    pSlot->length   = bodyLen;
+    pSlot->stamp    = pCache->pHeader->stamp;
+    pSlot->checksum = Checksum(pBody, bodyLen);
+
+    strcpy(pSlot->sid, pSID);
+
+    pCache->pHeader->dataSize += bodyLen;
+    pCache->stores++;
+
+    return true;
+}
+
+void EventCacheShowStats(EventCache *pCache)
+{
+    fprintf(stderr, "Cache Hits : %ld\n", pCache->hits);
+    fprintf(stderr, "Cache Miss : %ld\n", pCache->misses);
+    fprintf(stderr, "Cache Store: %ld\n", pCache->stores);
+    fprintf(stderr, "Cache Evict: %ld\n", pCache->evictions);
+    fprintf(stderr, "Cache Size : %llu bytes, %u entries\n", (unsigned long long) pCache->pHeader->dataSize, pCache->pHeader->count);
+}
@@ -0,0 +1,57 @@
+#ifndef EVENTCACHE_H
+#define EVENTCACHE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "arena.h"
+
+#define EVENT_CACHE_MAGIC   0x31435645
+#define EVENT_CACHE_VERSION 1
+#define EVENT_CACHE_SID_LEN 40
+
+// events.idx is a memory mapped open addressing table of SID -> (offset, length)
+// into the append only events.dat. Entries are stamped with the run that last
+// used them and the least recently used ones are dropped by compaction.
+
+typedef struct
+{
+    uint32_t magic, version;
+    uint32_t capacity, count;
+    uint64_t dataSize;
+    uint32_t stamp, reserved;
+} EventCacheHeader;
+
+typedef struct
+{
+    char     sid[EVENT_CACHE_SID_LEN];
+    uint64_t offset;
+    uint32_t length;
+    uint32_t stamp;
+    uint64_t checksum;
+} EventCacheSlot;
+
+typedef struct
+{
+    char             *pIndexPath, *pDataPath;
+    int              indexFD, dataFD;
+    EventCacheHeader *pHeader;
+    EventCacheSlot   *pSlots;
+    size_t           mapSize;
+    uint64_t         maxBytes;
+    uint32_t         maxEntries;
+    long             hits, misses, stores, evictions;
+} EventCache;
+
+EventCache *EventCacheOpen(const char *pDirectory, uint64_t maxBytes, uint32_t maxEntries);
+void        EventCacheClose(EventCache *pCache);
+
+// Returns a NUL terminated copy of the cached body allocated from pArena, NULL on a miss
+
+char *EventCacheLookup(EventCache *pCache, const char *pSID, Arena *pArena);
+bool  EventCacheStore(EventCache *pCache, const char *pSID, const char *pBody, size_t bodyLen);
+
+void  EventCacheShowStats(EventCache *pCache);
+
+#endif
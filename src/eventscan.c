@@ -0,0 +1,585 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "eventscan.h"
+
+// Nesting allowed in skipped values, the same limit jansson applies
+
+#define EVENT_SCAN_MAX_DEPTH 2048
+
+typedef struct
+{
+    const char    *pChar, *pEnd;
+    const Matcher *pMatcher;
+    Arena         *pArena;
+    MatchView     *pDigits;
+    bool          bEvents, bFound;
+} Scanner;
+
+typedef EventScanResult (*MemberFunc)(Scanner *pScanner, const MatchView *pKey);
+
+static void SkipSpace(Scanner *pScanner)
+{
+    while (pScanner->pChar < pScanner->pEnd)
+    {
+        char c = *pScanner->pChar;
+
+        if (c != ' ' && c != '\t' && c != '\n' && c != '\r')
+        {
+            break;
+        }
+
+        pScanner->pChar++;
+    }
+}
+
+static bool Expect(Scanner *pScanner, char c)
+{
+    SkipSpace(pScanner);
+
+    if (pScanner->pChar < pScanner->pEnd && *pScanner->pChar == c)
+    {
+        pScanner->pChar++;
+        return true;
+    }
+
+    return false;
+}
+
+static bool IsValueStart(Scanner *pScanner, char c)
+{
+    return pScanner->pChar < pScanner->pEnd && *pScanner->pChar == c;
+}
+
+static bool IsKey(const MatchView *pKey, const char *pName)
+{
+    size_t nameLen = strlen(pName);
+
+    return pKey->length == nameLen && memcmp(pKey->pStart, pName, nameLen) == 0;
+}
+
+static int HexValue(const char *pHex)
+{
+    int value = 0;
+
+    for (int index=0; index<4; index++)
+    {
+        char c = pHex[index];
+
+        value <<= 4;
+
+        if (c >= '0' && c <= '9')
+        {
+            value |= c - '0';
+        }
+        else if (c >= 'a' && c <= 'f')
+        {
+            value |= c - 'a' + 10;
+        }
+        else if (c >= 'A' && c <= 'F')
+        {
+            value |= c - 'A' + 10;
+        }
+        else
+        {
+            return -1;
+        }
+    }
+
+    return value;
+}
+
+// Cursor on the opening quote. Escapes and control characters are checked
+// but nothing is decoded.
+
+static bool SkipString(Scanner *pScanner)
+{
+    const char *pChar = pScanner->pChar + 1;
+
+    while (pChar < pScanner->pEnd)
+    {
+        unsigned char c = *pChar;
+
+        if (c == '"')
+        {
+            pScanner->pChar = pChar + 1;
+            return true;
+        }
+
+        if (c < 0x20)
+        {
+            return false;
+        }
+
+        if (c != '\\')
+        {
+            pChar++;
+            continue;
+        }
+
+        if (pScanner->pEnd - pChar < 2 || !pChar[1] || !strchr("\"\\/bfnrtu", pChar[1]))
+        {
+            return false;
+        }
+
+        if (pChar[1] != 'u')
+        {
+            pChar += 2;
+            continue;
+        }
+
+        // NUL and unpaired surrogates are refused like the full parser does
+
+        int codePoint = pScanner->pEnd - pChar >= 6 ? HexValue(pChar + 2) : -1;
+
+        pChar += 6;
+
+        if (codePoint <= 0 || (codePoint >= 0xdc00 && codePoint <= 0xdfff))
+        {
+            return false;
+        }
+
+        if (codePoint >= 0xd800 && codePoint <= 0xdbff)
+        {
+            int low = pScanner->pEnd - pChar >= 6 && pChar[0] == '\\' && pChar[1] == 'u' ? HexValue(pChar + 2) : -1;
+
+            if (low < 0xdc00 || low > 0xdfff)
+            {
+                return false;
+            }
+
+            pChar += 6;
+        }
+    }
+
+    return false;
+}
+
+static char *PutUTF8(char *pOut, uint32_t codePoint)
+{
+    if (codePoint < 0x80)
+    {
+        *pOut++ = codePoint;
+    }
+    else if (codePoint < 0x800)
+    {
+        *pOut++ = 0xc0 | (codePoint >> 6);
+        *pOut++ = 0x80 | (codePoint & 0x3f);
+    }
+    else if (codePoint < 0x10000)
+    {
+        *pOut++ = 0xe0 | (codePoint >> 12);
+        *pOut++ = 0x80 | ((codePoint >> 6) & 0x3f);
+        *pOut++ = 0x80 | (codePoint & 0x3f);
+    }
+    else
+    {
+        *pOut++ = 0xf0 | (codePoint >> 18);
+        *pOut++ = 0x80 | ((codePoint >> 12) & 0x3f);
+        *pOut++ = 0x80 | ((codePoint >> 6) & 0x3f);
+        *pOut++ = 0x80 | (codePoint & 0x3f);
+    }
+
+    return pOut;
+}
+
+// Decodes the string at the cursor. Strings without escapes are returned in
+// place, the rest are decoded into the arena, which never needs more than the
+// escaped length.
+
+static bool ReadString(Scanner *pScanner, MatchView *pValue)
+{
+    if (pScanner->pChar >= pScanner->pEnd || *pScanner->pChar != '"')
+    {
+        return false;
+    }
+
+    const char *pStart = pScanner->pChar + 1;
+    const char *pChar  = pStart;
+
+    while (pChar < pScanner->pEnd && *pChar != '"' && *pChar != '\\' && (unsigned char) *pChar >= 0x20)
+    {
+        pChar++;
+    }
+
+    if (pChar >= pScanner->pEnd || (unsigned char) *pChar < 0x20)
+    {
+        return false;
+    }
+
+    if (*pChar == '"')
+    {
+        pValue->pStart  = pStart;
+        pValue->length  = pChar - pStart;
+        pScanner->pChar = pChar + 1;
+        return true;
+    }
+
+    if (!SkipString(pScanner))
+    {
+        return false;
+    }
+
+    const char *pClose = pScanner->pChar - 1;
+
+    char *pDecoded = ArenaAlloc(pScanner->pArena, pClose - pStart + 1);
+
+    if (!pDecoded)
+    {
+        return false;
+    }
+
+    memcpy(pDecoded, pStart, pChar - pStart);
+
+    char *pOut = pDecoded + (pChar - pStart);
+
+    // SkipString has already checked every escape up to the closing quote
+
+    while (pChar < pClose)
+    {
+        if (*pChar != '\\')
+        {
+            *pOut++ = *pChar++;
+            continue;
+        }
+
+        char escape = pChar[1];
+
+        pChar += 2;
+
+        switch (escape)
+        {
+            case 'b':  *pOut++ = '\b'; break;
+            case 'f':  *pOut++ = '\f'; break;
+            case 'n':  *pOut++ = '\n'; break;
+            case 'r':  *pOut++ = '\r'; break;
+            case 't':  *pOut++ = '\t'; break;
+
+            case 'u':
+            {
+                uint32_t codePoint = HexValue(pChar);
+
+                pChar += 4;
+
+                if (codePoint >= 0xd800 && codePoint <= 0xdbff)
+                {
+                    codePoint = 0x10000 + ((codePoint - 0xd800) << 10) + (HexValue(pChar + 2) - 0xdc00);
+
+                    pChar += 6;
+                }
+
+                pOut = PutUTF8(pOut, codePoint);
+                break;
+            }
+
+            default:
+                *pOut++ = escape;
+                break;
+        }
+    }
+
+    *pOut = 0;
+
+    pValue->pStart = pDecoded;
+    pValue->length = pOut - pDecoded;
+
+    return true;
+}
+
+static bool SkipLiteral(Scanner *pScanner, const char *pLiteral)
+{
+    size_t literalLen = strlen(pLiteral);
+
+    if ((size_t) (pScanner->pEnd - pScanner->pChar) < literalLen || memcmp(pScanner->pChar, pLiteral, literalLen) != 0)
+    {
+        return false;
+    }
+
+    pScanner->pChar += literalLen;
+
+    return true;
+}
+
+static bool SkipDigits(Scanner *pScanner)
+{
+    const char *pStart = pScanner->pChar;
+
+    while (pScanner->pChar < pScanner->pEnd && *pScanner->pChar >= '0' && *pScanner->pChar <= '9')
+    {
+        pScanner->pChar++;
+    }
+
+    return pScanner->pChar > pStart;
+}
+
+static bool SkipNumber(Scanner *pScanner)
+{
+    if (IsValueStart(pScanner, '-'))
+    {
+        pScanner->pChar++;
+    }
+
+    if (IsValueStart(pScanner, '0'))
+    {
+        pScanner->pChar++;
+    }
+    else if (!SkipDigits(pScanner))
+    {
+        return false;
+    }
+
+    if (IsValueStart(pScanner, '.'))
+    {
+        pScanner->pChar++;
+
+        if (!SkipDigits(pScanner))
+        {
+            return false;
+        }
+    }
+
+    if (IsValueStart(pScanner, 'e') || IsValueStart(pScanner, 'E'))
+    {
+        pScanner->pChar++;
+
+        if (IsValueStart(pScanner, '+') || IsValueStart(pScanner, '-'))
+        {
+            pScanner->pChar++;
+        }
+
+        if (!SkipDigits(pScanner))
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+// Walks a value we don't need without decoding it, but with the same
+// grammar checks as a full parse
+
+static bool SkipValue(Scanner *pScanner, int depth)
+{
+    SkipSpace(pScanner);
+
+    if (pScanner->pChar >= pScanner->pEnd || depth > EVENT_SCAN_MAX_DEPTH)
+    {
+        return false;
+    }
+
+    switch (*pScanner->pChar)
+    {
+        case '"':
+            return SkipString(pScanner);
+
+        case '{':
+            pScanner->pChar++;
+
+            if (Expect(pScanner, '}'))
+            {
+                return true;
+            }
+
+            do
+            {
+                SkipSpace(pScanner);
+
+                if (!IsValueStart(pScanner, '"') || !SkipString(pScanner) || !Expect(pScanner, ':') || !SkipValue(pScanner, depth + 1))
+                {
+                    return false;
+                }
+            }
+            while (Expect(pScanner, ','));
+
+            return Expect(pScanner, '}');
+
+        case '[':
+            pScanner->pChar++;
+
+            if (Expect(pScanner, ']'))
+            {
+                return true;
+            }
+
+            do
+            {
+                if (!SkipValue(pScanner, depth + 1))
+                {
+                    return false;
+                }
+            }
+            while (Expect(pScanner, ','));
+
+            return Expect(pScanner, ']');
+
+        case 't':
+            return SkipLiteral(pScanner, "true");
+
+        case 'f':
+            return SkipLiteral(pScanner, "false");
+
+        case 'n':
+            return SkipLiteral(pScanner, "null");
+
+        default:
+            return SkipNumber(pScanner);
+    }
+}
+
+// Calls pMember with the cursor on each value, which it must consume
+
+static EventScanResult ScanObject(Scanner *pScanner, MemberFunc pMember)
+{
+    if (!Expect(pScanner, '{'))
+    {
+        return EVENT_SCAN_MALFORMED;
+    }
+
+    if (Expect(pScanner, '}'))
+    {
+        return EVENT_SCAN_NOT_FOUND;
+    }
+
+    while (1)
+    {
+        MatchView key;
+
+        SkipSpace(pScanner);
+
+        if (!ReadString(pScanner, &key) || !Expect(pScanner, ':'))
+        {
+            return EVENT_SCAN_MALFORMED;
+        }
+
+        SkipSpace(pScanner);
+
+        EventScanResult result = pMember(pScanner, &key);
+
+        if (result != EVENT_SCAN_NOT_FOUND)
+        {
+            return result;
+        }
+
+        if (Expect(pScanner, '}'))
+        {
+            return EVENT_SCAN_NOT_FOUND;
+        }
+
+        if (!Expect(pScanner, ','))
+        {
+            return EVENT_SCAN_MALFORMED;
+        }
+    }
+}
+
+// The first body the matcher accepts is kept, later ones are only skipped
+
+static EventScanResult ResponseMember(Scanner *pScanner, const MatchView *pKey)
+{
+    if (!pScanner->bFound && IsKey(pKey, "response_body") && IsValueStart(pScanner, '"'))
+    {
+        MatchView body;
+
+        if (!ReadString(pScanner, &body))
+        {
+            return EVENT_SCAN_MALFORMED;
+        }
+
+        pScanner->bFound = MatcherFind(pScanner->pMatcher, body.pStart, body.length, pScanner->pDigits) >= 0;
+
+        return EVENT_SCAN_NOT_FOUND;
+    }
+
+    return SkipValue(pScanner, 0) ? EVENT_SCAN_NOT_FOUND : EVENT_SCAN_MALFORMED;
+}
+
+static EventScanResult EventMember(Scanner *pScanner, const MatchView *pKey)
+{
+    if (IsKey(pKey, "response") && IsValueStart(pScanner, '{'))
+    {
+        return ScanObject(pScanner, ResponseMember);
+    }
+
+    return SkipValue(pScanner, 0) ? EVENT_SCAN_NOT_FOUND : EVENT_SCAN_MALFORMED;
+}
+
+static EventScanResult ScanEvents(Scanner *pScanner)
+{
+    pScanner->pChar++;
+
+    if (Expect(pScanner, ']'))
+    {
+        return EVENT_SCAN_NOT_FOUND;
+    }
+
+    while (1)
+    {
+        SkipSpace(pScanner);
+
+        EventScanResult result = IsValueStart(pScanner, '{') ? ScanObject(pScanner, EventMember) :
+                                 SkipValue(pScanner, 0)      ? EVENT_SCAN_NOT_FOUND : EVENT_SCAN_MALFORMED;
+
+        if (result != EVENT_SCAN_NOT_FOUND)
+        {
+            return result;
+        }
+
+        if (Expect(pScanner, ']'))
+        {
+            return EVENT_SCAN_NOT_FOUND;
+        }
+
+        if (!Expect(pScanner, ','))
+        {
+            return EVENT_SCAN_MALFORMED;
+        }
+    }
+}
+
+static EventScanResult TopMember(Scanner *pScanner, const MatchView *pKey)
+{
+    if (IsKey(pKey, "events"))
+    {
+        pScanner->bEvents = true;
+
+        if (IsValueStart(pScanner, '['))
+        {
+            return ScanEvents(pScanner);
+        }
+    }
+
+    return SkipValue(pScanner, 0) ? EVENT_SCAN_NOT_FOUND : EVENT_SCAN_MALFORMED;
+}
+
+EventScanResult EventScan(const char *pJSON, size_t jsonLen, const Matcher *pMatcher, Arena *pArena, MatchView *pDigits)
+{
+    Scanner scanner = { pJSON, pJSON + jsonLen, pMatcher, pArena, pDigits, false, false };
+
+    SkipSpace(&scanner);
+
+    EventScanResult result = ScanObject(&scanner, TopMember);
+
+    if (result != EVENT_SCAN_NOT_FOUND)
+    {
+        return result;
+    }
+
+    // The whole body has been walked, match or not, so a truncated response
+    // is never counted. Only trailing whitespace may follow.
+
+    SkipSpace(&scanner);
+
+    if (scanner.pChar != scanner.pEnd)
+    {
+        return EVENT_SCAN_MALFORMED;
+    }
+
+    if (scanner.bFound)
+    {
+        return EVENT_SCAN_FOUND;
+    }
+
+    return scanner.bEvents ? EVENT_SCAN_NOT_FOUND : EVENT_SCAN_NO_EVENTS;
+}
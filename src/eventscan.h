@@ -0,0 +1,31 @@
+#ifndef EVENTSCAN_H
+#define EVENTSCAN_H
+
+#include <stddef.h>
+
+#include "arena.h"
+#include "matcher.h"
+
+// Lazy alternative to loading an Events.json body into a DOM. Walks
+// events[].response.response_body in the raw text, skipping every other value
+// without decoding it, and keeps the first body the matcher accepts. The rest
+// of the document is still walked, so a match in a truncated response is
+// reported as malformed. Skipped values get the grammar checks of a full
+// parse, UTF-8 aside.
+// Anything unexpected is reported as malformed so the caller can fall back to
+// the full parser.
+
+typedef enum
+{
+    EVENT_SCAN_FOUND,
+    EVENT_SCAN_NOT_FOUND,
+    EVENT_SCAN_NO_EVENTS,
+    EVENT_SCAN_MALFORMED
+} EventScanResult;
+
+// pDigits is set for EVENT_SCAN_FOUND and points into pJSON, or into pArena
+// when the body had escapes to decode
+
+EventScanResult EventScan(const char *pJSON, size_t jsonLen, const Matcher *pMatcher, Arena *pArena, MatchView *pDigits);
+
+#endif
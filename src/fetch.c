@@ -0,0 +1,272 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <curl/curl.h>
+#include <curl/multi.h>
+#include <glib.h>
+
+#include "fetch.h"
+#include "metrics.h"
+#include "throttle.h"
+#include "transport.h"
+
+bool FetchEngineInit(FetchEngine *pEngine, int maxInFlight, int queueDepth)
+{
+    memset(pEngine, 0, sizeof(FetchEngine));
+
+    pEngine->maxInFlight = maxInFlight > 0 ? maxInFlight : 1;
+    pEngine->queueDepth  = queueDepth  > 0 ? queueDepth  : 1;
+
+    pEngine->pMulti = curl_multi_init();
+    pEngine->pSlots = calloc(pEngine->maxInFlight, sizeof(FetchSlot));
+    pEngine->pQueue = calloc(pEngine->queueDepth,  sizeof(FetchRequest));
+
+    if (!pEngine->pMulti || !pEngine->pSlots || !pEngine->pQueue)
+    {
+        fprintf(stderr, "Failure allocating fetch engine\n");
+
+        FetchEngineCleanup(pEngine);
+        return false;
+    }
+
+    for (int index=0; index<pEngine->maxInFlight; index++)
+    {
+        pEngine->pSlots[index].pCurl = TransportAcquire();
+
+        if (!pEngine->pSlots[index].pCurl)
+        {
+            fprintf(stderr, "Failure creating curl handle for fetch slot %d\n", index);
+
+            FetchEngineCleanup(pEngine);
+            return false;
+        }
+    }
+
+    curl_multi_setopt(pEngine->pMulti, CURLMOPT_MAX_TOTAL_CONNECTIONS, (long) pEngine->maxInFlight);
+
+    return true;
+}
+
+static void FetchEngineStart(FetchEngine *pEngine, FetchSlot *pSlot)
+{
+    if (!pSlot->bBusy)
+    {
+        pSlot->request  = pEngine->pQueue[pEngine->queueHead];
+        pSlot->attempts = 0;
+        pSlot->bBusy    = true;
+
+        pEngine->queueHead = (pEngine->queueHead + 1) % pEngine->queueDepth;
+        pEngine->queueCount--;
+        pEngine->busy++;
+    }
+
+    pSlot->bWaiting = false;
+    pSlot->attempts++;
+
+    InitResponseString(&pSlot->response);
+
+    curl_easy_setopt(pSlot->pCurl, CURLOPT_URL, pSlot->request.pURL);
+    curl_easy_setopt(pSlot->pCurl, CURLOPT_WRITEFUNCTION, ResponseWrite);
+    curl_easy_setopt(pSlot->pCurl, CURLOPT_WRITEDATA, &pSlot->response);
+    curl_easy_setopt(pSlot->pCurl, CURLOPT_TIMEOUT_MS, 4000L);
+    curl_easy_setopt(pSlot->pCurl, CURLOPT_PRIVATE, pSlot);
+
+    if (pSlot->request.pUserPass)
+    {
+        curl_easy_setopt(pSlot->pCurl, CURLOPT_USERPWD, pSlot->request.pUserPass);
+    }
+
+    curl_multi_add_handle(pEngine->pMulti, pSlot->pCurl);
+
+    pEngine->inFlight++;
+}
+
+// Throttled requests waiting for a retry go out before anything new is dequeued
+
+static void FetchEngineStartQueued(FetchEngine *pEngine)
+{
+    for (int pass=0; pass<2; pass++)
+    {
+        for (int index=0; index<pEngine->maxInFlight; index++)
+        {
+            FetchSlot *pSlot = &pEngine->pSlots[index];
+
+            bool bReady = pass == 0 ? pSlot->bBusy && pSlot->bWaiting : !pSlot->bBusy && pEngine->queueCount > 0;
+
+            if (!bReady)
+            {
+                continue;
+            }
+
+            if (!ThrottleTryAcquire(pEngine->inFlight))
+            {
+                return;
+            }
+
+            FetchEngineStart(pEngine, pSlot);
+        }
+    }
+}
+
+static void FetchEngineComplete(FetchEngine *pEngine, CURLMsg *pMsg)
+{
+    FetchSlot *pSlot = NULL;
+
+    curl_easy_getinfo(pMsg->easy_handle, CURLINFO_PRIVATE, (char **) &pSlot);
+
+    int status = 500;
+
+    if (pMsg->data.result == CURLE_OK)
+    {
+        long responseCode = 0;
+
+        if (curl_easy_getinfo(pSlot->pCurl, CURLINFO_RESPONSE_CODE, &responseCode) == CURLE_OK)
+        {
+            status = responseCode;
+        }
+    }
+
+    TransportCount(pSlot->pCurl);
+
+    MetricsRecordRequest(pSlot->pCurl, pMsg->data.result == CURLE_OK ? status : 0);
+
+    curl_multi_remove_handle(pEngine->pMulti, pSlot->pCurl);
+
+    pEngine->inFlight--;
+
+    if (ThrottleComplete(pSlot->pCurl, status))
+    {
+        if (pSlot->attempts < THROTTLE_MAX_ATTEMPTS)
+        {
+            FreeString(&pSlot->response.pCharData);
+
+            pSlot->bWaiting = true;
+            return;
+        }
+
+        fprintf(stderr, "Giving up on %s after %d throttled attempts\n", pSlot->request.pURL, pSlot->attempts);
+    }
+
+    pSlot->request.pCallback(status, status == 200 ? pSlot->response.pCharData : NULL, pSlot->request.pUserData);
+
+    FreeString(&pSlot->response.pCharData);
+
+    pSlot->bBusy = false;
+    pEngine->busy--;
+}
+
+static void FetchEnginePump(FetchEngine *pEngine, int waitMs)
+{
+    FetchEngineStartQueued(pEngine);
+
+    int running = 0;
+
+    curl_multi_perform(pEngine->pMulti, &running);
+
+    CURLMsg *pMsg;
+    int     msgsLeft;
+
+    while ((pMsg = curl_multi_info_read(pEngine->pMulti, &msgsLeft)))
+    {
+        if (pMsg->msg == CURLMSG_DONE)
+        {
+            FetchEngineComplete(pEngine, pMsg);
+        }
+    }
+
+    FetchEngineStartQueued(pEngine);
+
+    if (waitMs > 0 && pEngine->inFlight > 0)
+    {
+        curl_multi_poll(pEngine->pMulti, NULL, 0, waitMs, NULL);
+    }
+    else if (waitMs > 0 && !FetchEngineIdle(pEngine))
+    {
+        // Nothing running but work is held back by the throttle
+
+        int delayMs = ThrottleDelayMs();
+
+        if (delayMs > 0)
+        {
+            g_usleep((gulong) (delayMs < waitMs ? delayMs : waitMs) * 1000);
+        }
+        else
+        {
+            // A token is free already, start the held work rather than sleep
+
+            FetchEngineStartQueued(pEngine);
+        }
+    }
+}
+
+void FetchEngineSubmit(FetchEngine *pEngine, const char *pURL, const char *pUserPass, FetchCallback pCallback, void *pUserData)
+{
+    while (pEngine->queueCount == pEngine->queueDepth)
+    {
+        FetchEnginePump(pEngine, 1000);
+    }
+
+    FetchRequest *pRequest = &pEngine->pQueue[(pEngine->queueHead + pEngine->queueCount) % pEngine->queueDepth];
+
+    pRequest->pURL      = pURL;
+    pRequest->pUserPass = pUserPass;
+    pRequest->pCallback = pCallback;
+    pRequest->pUserData = pUserData;
+
+    pEngine->queueCount++;
+
+    FetchEnginePump(pEngine, 0);
+}
+
+bool FetchEngineIdle(FetchEngine *pEngine)
+{
+    return pEngine->queueCount == 0 && pEngine->busy == 0;
+}
+
+void FetchEngineWait(FetchEngine *pEngine, int timeoutMs)
+{
+    FetchEnginePump(pEngine, timeoutMs);
+}
+
+void FetchEngineDrain(FetchEngine *pEngine)
+{
+    while (!FetchEngineIdle(pEngine))
+    {
+        FetchEnginePump(pEngine, 1000);
+    }
+}
+
+void FetchEngineCleanup(FetchEngine *pEngine)
+{
+    if (pEngine->pSlots)
+    {
+        for (int index=0; index<pEngine->maxInFlight; index++)
+        {
+            FetchSlot *pSlot = &pEngine->pSlots[index];
+
+            if (pSlot->bBusy && !pSlot->bWaiting)
+            {
+                curl_multi_remove_handle(pEngine->pMulti, pSlot->pCurl);
+
+                FreeString(&pSlot->response.pCharData);
+            }
+
+            TransportRelease(pSlot->pCurl);
+        }
+
+        free(pEngine->pSlots);
+        pEngine->pSlots = NULL;
+    }
+
+    if (pEngine->pQueue)
+    {
+        free(pEngine->pQueue);
+        pEngine->pQueue = NULL;
+    }
+
+    if (pEngine->pMulti)
+    {
+        curl_multi_cleanup(pEngine->pMulti);
+        pEngine->pMulti = NULL;
+    }
+}
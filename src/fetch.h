@@ -0,0 +1,56 @@
+#ifndef FETCH_H
+#define FETCH_H
+
+#include <stdbool.h>
+#include <curl/curl.h>
+
+#include "cantv.h"
+
+// pResponse is NULL unless statusCode is 200 and is freed by the engine once the callback returns
+
+typedef void (*FetchCallback)(int statusCode, const char *pResponse, void *pUserData);
+
+typedef struct
+{
+    const char    *pURL;
+    const char    *pUserPass;
+    FetchCallback pCallback;
+    void          *pUserData;
+} FetchRequest;
+
+typedef struct
+{
+    CURL          *pCurl;
+    struct string response;
+    FetchRequest  request;
+    bool          bBusy, bWaiting;
+    int           attempts;
+} FetchSlot;
+
+typedef struct
+{
+    CURLM        *pMulti;
+    FetchSlot    *pSlots;
+    int          maxInFlight, inFlight, busy;
+    FetchRequest *pQueue;
+    int          queueDepth, queueHead, queueCount;
+} FetchEngine;
+
+bool FetchEngineInit(FetchEngine *pEngine, int maxInFlight, int queueDepth);
+
+// pURL must stay valid until the callback runs, blocks while the queue is full.
+// Requests rejected with 429/503 keep their slot and are sent again once the
+// throttle allows, up to THROTTLE_MAX_ATTEMPTS times.
+
+void FetchEngineSubmit(FetchEngine *pEngine, const char *pURL, const char *pUserPass, FetchCallback pCallback, void *pUserData);
+
+bool FetchEngineIdle(FetchEngine *pEngine);
+
+// Drives transfers for up to timeoutMs, returning early on socket activity or when nothing is in flight
+
+void FetchEngineWait(FetchEngine *pEngine, int timeoutMs);
+
+void FetchEngineDrain(FetchEngine *pEngine);
+void FetchEngineCleanup(FetchEngine *pEngine);
+
+#endif
@@ -0,0 +1,233 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "keytable.h"
+
+#define KEY_TABLE_INITIAL_BITS 8
+
+static uint32_t HashKey(int key, uint32_t bits)
+{
+    return ((uint32_t) key * 0x9E3779B1u) >> (32 - bits);
+}
+
+static KeySlot *FindSlot(KeySlot *pSlots, uint32_t bits, int key)
+{
+    uint32_t mask = (1u << bits) - 1;
+    uint32_t slot = HashKey(key, bits);
+
+    while (pSlots[slot].row && pSlots[slot].key != key)
+    {
+        slot = (slot + 1) & mask;
+    }
+
+    return &pSlots[slot];
+}
+
+KeyTable *KeyTableNew(void)
+{
+    KeyTable *pTable = calloc(1, sizeof(KeyTable));
+
+    if (!pTable)
+    {
+        return NULL;
+    }
+
+    pTable->bits     = KEY_TABLE_INITIAL_BITS;
+    pTable->capacity = 1u << pTable->bits;
+    pTable->pSlots   = calloc(pTable->capacity, sizeof(KeySlot));
+
+    if (!pTable->pSlots)
+    {
+        free(pTable);
+        return NULL;
+    }
+
+    return pTable;
+}
+
+void KeyTableFree(KeyTable *pTable)
+{
+    if (pTable)
+    {
+        free(pTable->pSlots);
+        free(pTable->pKeys);
+        free(pTable->pCounts);
+        free(pTable);
+    }
+}
+
+static bool GrowSlots(KeyTable *pTable)
+{
+    uint32_t bits     = pTable->bits + 1;
+    uint32_t capacity = 1u << bits;
+    KeySlot  *pSlots  = calloc(capacity, sizeof(KeySlot));
+
+    if (!pSlots)
+    {
+        fprintf(stderr, "Failure growing key table to %u slots\n", capacity);
+        return false;
+    }
+
+    for (uint32_t slot=0; slot<pTable->capacity; slot++)
+    {
+        if (pTable->pSlots[slot].row)
+        {
+            *FindSlot(pSlots, bits, pTable->pSlots[slot].key) = pTable->pSlots[slot];
+        }
+    }
+
+    free(pTable->pSlots);
+
+    pTable->pSlots   = pSlots;
+    pTable->bits     = bits;
+    pTable->capacity = capacity;
+
+    return true;
+}
+
+static bool GrowRows(KeyTable *pTable)
+{
+    uint32_t rowCapacity = pTable->rowCapacity ? pTable->rowCapacity * 2 : 64;
+
+    int *pKeys   = realloc(pTable->pKeys,   sizeof(int) * rowCapacity);
+
+    if (pKeys)
+    {
+        pTable->pKeys = pKeys;
+    }
+
+    int *pCounts = realloc(pTable->pCounts, sizeof(int) * KEY_TABLE_COLUMNS * rowCapacity);
+
+    if (pCounts)
+    {
+        pTable->pCounts = pCounts;
+    }
+
+    if (!pKeys || !pCounts)
+    {
+        fprintf(stderr, "Failure growing key table to %u rows\n", rowCapacity);
+        return false;
+    }
+
+    pTable->rowCapacity = rowCapacity;
+
+    return true;
+}
+
+int *KeyTableRow(KeyTable *pTable, int key)
+{
+    KeySlot *pSlot = FindSlot(pTable->pSlots, pTable->bits, key);
+
+    if (pSlot->row)
+    {
+        return &pTable->pCounts[(size_t) (pSlot->row - 1) * KEY_TABLE_COLUMNS];
+    }
+
+    if ((pTable->rows + 1) * 4 > pTable->capacity * 3)
+    {
+        if (!GrowSlots(pTable))
+        {
+            return NULL;
+        }
+
+        pSlot = FindSlot(pTable->pSlots, pTable->bits, key);
+    }
+
+    if (pTable->rows == pTable->rowCapacity && !GrowRows(pTable))
+    {
+        return NULL;
+    }
+
+    uint32_t row = pTable->rows++;
+
+    pSlot->key = key;
+    pSlot->row = row + 1;
+
+    pTable->pKeys[row] = key;
+
+    int *pCounts = &pTable->pCounts[(size_t) row * KEY_TABLE_COLUMNS];
+
+    memset(pCounts, 0, sizeof(int) * KEY_TABLE_COLUMNS);
+
+    return pCounts;
+}
+
+void KeyTableAdd(KeyTable *pTable, int key, int day)
+{
+    int *pCounts = KeyTableRow(pTable, key);
+
+    if (pCounts)
+    {
+        if (day > 0 && day < KEY_TABLE_COLUMNS)
+        {
+            pCounts[day]++;
+        }
+
+        pCounts[0]++;
+    }
+}
+
+bool KeyTableMerge(KeyTable *pTable, const KeyTable *pOther)
+{
+    for (uint32_t row=0; row<pOther->rows; row++)
+    {
+        int *pCounts = KeyTableRow(pTable, pOther->pKeys[row]);
+
+        if (!pCounts)
+        {
+            return false;
+        }
+
+        const int *pOtherCounts = &pOther->pCounts[(size_t) row * KEY_TABLE_COLUMNS];
+
+        for (int column=0; column<KEY_TABLE_COLUMNS; column++)
+        {
+            pCounts[column] += pOtherCounts[column];
+        }
+    }
+
+    return true;
+}
+
+void KeyTableForEach(KeyTable *pTable, KeyTableFunc pFunc, void *pUserData)
+{
+    for (uint32_t row=0; row<pTable->rows; row++)
+    {
+        pFunc(pTable->pKeys[row], &pTable->pCounts[(size_t) row * KEY_TABLE_COLUMNS], pUserData);
+    }
+}
+
+static int CompareKeys(const void *pA, const void *pB)
+{
+    int a = ((const KeySlot *) pA)->key;
+    int b = ((const KeySlot *) pB)->key;
+
+    return a < b ? -1 : a > b ? 1 : 0;
+}
+
+void KeyTableForEachSorted(KeyTable *pTable, KeyTableFunc pFunc, void *pUserData)
+{
+    KeySlot *pOrder = malloc(sizeof(KeySlot) * (pTable->rows + 1));
+
+    if (!pOrder)
+    {
+        KeyTableForEach(pTable, pFunc, pUserData);
+        return;
+    }
+
+    for (uint32_t row=0; row<pTable->rows; row++)
+    {
+        pOrder[row].key = pTable->pKeys[row];
+        pOrder[row].row = row;
+    }
+
+    qsort(pOrder, pTable->rows, sizeof(KeySlot), CompareKeys);
+
+    for (uint32_t index=0; index<pTable->rows; index++)
+    {
+        pFunc(pOrder[index].key, &pTable->pCounts[(size_t) pOrder[index].row * KEY_TABLE_COLUMNS], pUserData);
+    }
+
+    free(pOrder);
+}
@@ -0,0 +1,46 @@
+#ifndef KEYTABLE_H
+#define KEYTABLE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define KEY_TABLE_COLUMNS 32
+#define KEY_TABLE_INVALID 1000000000
+
+// Open addressing table from an integer key to a row of KEY_TABLE_COLUMNS
+// counts (column 0 is the total, 1..31 the day of month). Rows are stored
+// contiguously in one slab in insertion order.
+
+typedef struct
+{
+    int      key;
+    uint32_t row;
+} KeySlot;
+
+typedef struct
+{
+    KeySlot  *pSlots;
+    uint32_t capacity, bits;
+    int      *pKeys;
+    int      *pCounts;
+    uint32_t rows, rowCapacity;
+} KeyTable;
+
+typedef void (*KeyTableFunc)(int key, const int *pCounts, void *pUserData);
+
+KeyTable *KeyTableNew(void);
+void      KeyTableFree(KeyTable *pTable);
+
+// Finds or creates the row for key, NULL only on allocation failure
+
+int      *KeyTableRow(KeyTable *pTable, int key);
+void      KeyTableAdd(KeyTable *pTable, int key, int day);
+
+// Adds every row of pOther into pTable, false on allocation failure
+
+bool      KeyTableMerge(KeyTable *pTable, const KeyTable *pOther);
+
+void      KeyTableForEach(KeyTable *pTable, KeyTableFunc pFunc, void *pUserData);
+void      KeyTableForEachSorted(KeyTable *pTable, KeyTableFunc pFunc, void *pUserData);
+
+#endif
@@ -10,11 +10,30 @@
 #include <strings.h>
 #include <libgen.h>
 #include <sys/stat.h>
-
-typedef struct 
-{
-    const char *pStartDate, *pEndDate, *pAccount, *pAPIKey, *pEmailFrom, *pEmailTo, *pEmailFromName, *pEmailPassword;
-} CmdLineArgs;
+#include <zlib.h>
+#include <ctype.h>
+#include <signal.h>
+#include <malloc.h>
+
+#include "cantv.h"
+#include "arena.h"
+#include "base64.h"
+#include "callparser.h"
+#include "callqueue.h"
+#include "callstore.h"
+#include "checkpoint.h"
+#include "dump.h"
+#include "eventscan.h"
+#include "eventcache.h"
+#include "fetch.h"
+#include "keytable.h"
+#include "matcher.h"
+#include "metrics.h"
+#include "reportbuffer.h"
+#include "service.h"
+#include "throttle.h"
+#include "transport.h"
+#include "workpool.h"
 
 CmdLineArgs g_cmdArgs;
 
@@ -63,12 +82,6 @@ void FreeString(char **pString)
    }
 }
 
-struct string 
-{
-    char   *pCharData;
-    size_t dataLen;
-};
-
 void InitResponseString(struct string *s) 
 {
     s->dataLen = 0;
@@ -103,99 +116,6 @@ size_t ResponseWrite(void *ptr, size_t size, size_t nmemb, struct string *s)
     return size * nmemb;
 }
 
-static char *decoding_table = NULL;
-
-static char encoding_table[] = {'A', 'B', 'C', 'D', 'E', 'F', 'G', 'H',
-                                'I', 'J', 'K', 'L', 'M', 'N', 'O', 'P',
-                                'Q', 'R', 'S', 'T', 'U', 'V', 'W', 'X',
-                                'Y', 'Z', 'a', 'b', 'c', 'd', 'e', 'f',
-                                'g', 'h', 'i', 'j', 'k', 'l', 'm', 'n',
-                                'o', 'p', 'q', 'r', 's', 't', 'u', 'v',
-                                'w', 'x', 'y', 'z', '0', '1', '2', '3',
-                                '4', '5', '6', '7', '8', '9', '+', '/'};
-
-void build_decoding_table() 
-{
-    decoding_table = malloc(256);
-
-    for (int i = 0; i < 64; i++)
-    {
-        decoding_table[(unsigned char) encoding_table[i]] = i;
-    }
-}
-
-void base64_cleanup() 
-{
-    free(decoding_table);
-}
-
-static int mod_table[] = {0, 2, 1};
-
-#define uint32_t unsigned int
-
-char *base64_encode(const unsigned char *data, size_t input_length, size_t *output_length) 
-{
-    *output_length = 4 * ((input_length + 2) / 3);
-
-    char *encoded_data = malloc(*output_length);
-
-    if (encoded_data == NULL) return NULL;
-
-    for (int i = 0, j = 0; i < input_length;) {
-
-        uint32_t octet_a = i < input_length ? (unsigned char)data[i++] : 0;
-        uint32_t octet_b = i < input_length ? (unsigned char)data[i++] : 0;
-        uint32_t octet_c = i < input_length ? (unsigned char)data[i++] : 0;
-
-        uint32_t triple = (octet_a << 0x10) + (octet_b << 0x08) + octet_c;
-
-        encoded_data[j++] = encoding_table[(triple >> 3 * 6) & 0x3F];
-        encoded_data[j++] = encoding_table[(triple >> 2 * 6) & 0x3F];
-        encoded_data[j++] = encoding_table[(triple >> 1 * 6) & 0x3F];
-        encoded_data[j++] = encoding_table[(triple >> 0 * 6) & 0x3F];
-    }
-
-    for (int i = 0; i < mod_table[input_length % 3]; i++)
-        encoded_data[*output_length - 1 - i] = '=';
-
-    return encoded_data;
-}
-
-unsigned char *base64_decode(const char *data,
-                             size_t input_length,
-                             size_t *output_length) {
-
-    if (decoding_table == NULL) build_decoding_table();
-
-    if (input_length % 4 != 0) return NULL;
-
-    *output_length = input_length / 4 * 3;
-    if (data[input_length - 1] == '=') (*output_length)--;
-    if (data[input_length - 2] == '=') (*output_length)--;
-
-    unsigned char *decoded_data = malloc(*output_length);
-    if (decoded_data == NULL) return NULL;
-
-    for (int i = 0, j = 0; i < input_length;) {
-
-        uint32_t sextet_a = data[i] == '=' ? 0 & i++ : decoding_table[data[i++]];
-        uint32_t sextet_b = data[i] == '=' ? 0 & i++ : decoding_table[data[i++]];
-        uint32_t sextet_c = data[i] == '=' ? 0 & i++ : decoding_table[data[i++]];
-        uint32_t sextet_d = data[i] == '=' ? 0 & i++ : decoding_table[data[i++]];
-
-        uint32_t triple = (sextet_a << 3 * 6)
-        + (sextet_b << 2 * 6)
-        + (sextet_c << 1 * 6)
-        + (sextet_d << 0 * 6);
-
-        if (j < *output_length) decoded_data[j++] = (triple >> 2 * 8) & 0xFF;
-        if (j < *output_length) decoded_data[j++] = (triple >> 1 * 8) & 0xFF;
-        if (j < *output_length) decoded_data[j++] = (triple >> 0 * 8) & 0xFF;
-    }
-
-    return decoded_data;
-}
-
 #ifdef COMMENT_OUT
 
 curl --ssl-reqd \
@@ -227,63 +147,272 @@ static const char *s_pPayloadFormat =
   "MIME-Version: 1.0\r\n"
   "Content-Type: multipart/mixed; boundary=\"MULTIPART-MIXED-BOUNDARY\"\r\n"
   "\r\n"
-  "CANTV Report is attached\r\n"
+  "CANTV Report is attached\r\n";
+
+static const char *s_pPartFormat = 
   "--MULTIPART-MIXED-BOUNDARY\r\n"
-  "Content-Type: text/plain; charset=utf-8\r\n"
+  "Content-Type: %s\r\n"
   "Content-Transfer-Encoding: base64\r\n"
-  "Content-Disposition: attachment; filename=\"report.csv\"\r\n%s";
+  "Content-Disposition: attachment; filename=\"%s%s\"\r\n"
+  "\r\n";
 
-struct upload_status 
+static const char *s_pPayloadTrailer = 
+  "--MULTIPART-MIXED-BOUNDARY--\r\n";
+
+// Whole base64 lines are encoded per read so only the last one is padded
+
+#define PAYLOAD_CHUNK_LINES 64
+#define PAYLOAD_CHUNK_BYTES (BASE64_LINE_BYTES * PAYLOAD_CHUNK_LINES)
+#define PAYLOAD_INPUT_BYTES 16384
+
+typedef enum
 {
-    int bytesRemaining;
-    char *pBuffer;
-};
+    PAYLOAD_HEADERS,
+    PAYLOAD_PART,
+    PAYLOAD_ATTACHMENT,
+    PAYLOAD_TRAILER,
+    PAYLOAD_DONE
+} PayloadStage;
+
+// An attachment is either already in memory or the file named pName
+
+typedef struct
+{
+    const char *pName;
+    const char *pData;
+    size_t     dataLen;
+} EmailAttachment;
+
+// The message is generated as curl pulls it: headers, then for each
+// attachment its part headers and the contents encoded a chunk at a time,
+// then the closing boundary. Encoded chunks go straight into curl's buffer
+// when they fit, pPending holds the rest. With bCompress each attachment is
+// gzipped on the way, raw then holds deflate output.
+
+typedef struct
+{
+    PayloadStage          stage;
+    const EmailAttachment *pAttachments;
+    FILE                  **ppFiles;
+    int                   attachments, current;
+    FILE                  *pAttachment;
+    size_t                consumed;
+    char                  *pHeaders, *pPartHeaders;
+    bool          bCompress, bInputDone;
+    z_stream      zStream;
+    unsigned char input[PAYLOAD_INPUT_BYTES];
+    unsigned char raw[PAYLOAD_CHUNK_BYTES];
+    char          encoded[PAYLOAD_CHUNK_LINES * (BASE64_LINE_CHARS + 2) + 1];
+    const char    *pPending;
+    size_t        pendingLen;
+} PayloadSource;
+
+// Points *ppRaw at the next chunk to encode, short only at the end of the
+// attachment. Attachments in memory are encoded or deflated where they are.
+
+static size_t PayloadFill(PayloadSource *pSource, const unsigned char **ppRaw)
+{
+    const EmailAttachment *pAttachment = &pSource->pAttachments[pSource->current];
+
+    *ppRaw = pSource->raw;
+
+    if (!pSource->bCompress)
+    {
+        if (!pAttachment->pData)
+        {
+            return fread(pSource->raw, 1, PAYLOAD_CHUNK_BYTES, pSource->pAttachment);
+        }
+
+        size_t rawLen = pAttachment->dataLen - pSource->consumed < PAYLOAD_CHUNK_BYTES ? pAttachment->dataLen - pSource->consumed : PAYLOAD_CHUNK_BYTES;
+
+        *ppRaw = (const unsigned char *) pAttachment->pData + pSource->consumed;
+
+        pSource->consumed += rawLen;
+
+        return rawLen;
+    }
+
+    z_stream *pZStream = &pSource->zStream;
 
-char *g_pPayloadText = NULL;
+    pZStream->next_out  = pSource->raw;
+    pZStream->avail_out = PAYLOAD_CHUNK_BYTES;
 
-size_t g_bytesRemaining = -1;
+    while (pZStream->avail_out > 0)
+    {
+        if (pZStream->avail_in == 0 && !pSource->bInputDone)
+        {
+            if (pAttachment->pData)
+            {
+                pZStream->next_in  = (Bytef *) pAttachment->pData;
+                pZStream->avail_in = pAttachment->dataLen;
+
+                pSource->bInputDone = true;
+            }
+            else
+            {
+                pZStream->next_in  = pSource->input;
+                pZStream->avail_in = fread(pSource->input, 1, PAYLOAD_INPUT_BYTES, pSource->pAttachment);
+
+                pSource->bInputDone = pZStream->avail_in < PAYLOAD_INPUT_BYTES;
+            }
+        }
+
+        int result = deflate(pZStream, pSource->bInputDone ? Z_FINISH : Z_NO_FLUSH);
+
+        if (result == Z_STREAM_END || result == Z_STREAM_ERROR)
+        {
+            break;
+        }
+    }
+
+    return PAYLOAD_CHUNK_BYTES - pZStream->avail_out;
+}
 
 static size_t payload_source(void *ptr, size_t size, size_t nmemb, void *userp)
 {
-    struct upload_status *upload_ctx = (struct upload_status *) userp;
+    PayloadSource *pSource = (PayloadSource *) userp;
 
-    int maxCopy = size * nmemb;
+    char   *pOut   = (char *) ptr;
+    size_t maxCopy = size * nmemb;
+    size_t copied  = 0;
 
-    if ((size == 0) || (nmemb == 0) || (maxCopy < 1) || (upload_ctx->bytesRemaining == 0))
+    while (copied < maxCopy)
     {
-        return 0;
-    }
+        if (pSource->pendingLen > 0)
+        {
+            size_t bytesToCopy = maxCopy - copied < pSource->pendingLen ? maxCopy - copied : pSource->pendingLen;
+
+            memcpy(pOut + copied, pSource->pPending, bytesToCopy);
+
+            pSource->pPending   += bytesToCopy;
+            pSource->pendingLen -= bytesToCopy;
+
+            copied += bytesToCopy;
+            continue;
+        }
+
+        if (pSource->stage == PAYLOAD_HEADERS)
+        {
+            pSource->pPending   = pSource->pHeaders;
+            pSource->pendingLen = strlen(pSource->pHeaders);
+            pSource->stage      = pSource->attachments > 0 ? PAYLOAD_PART : PAYLOAD_TRAILER;
+        }
+        else if (pSource->stage == PAYLOAD_PART)
+        {
+            pSource->pAttachment = pSource->ppFiles[pSource->current];
+            pSource->consumed    = 0;
+            pSource->bInputDone  = false;
+
+            if (pSource->bCompress)
+            {
+                deflateReset(&pSource->zStream);
+            }
+
+            FreeString(&pSource->pPartHeaders);
 
-    int bytesToCopy = maxCopy > upload_ctx->bytesRemaining ? upload_ctx->bytesRemaining : maxCopy;
+            asprintf(&pSource->pPartHeaders, s_pPartFormat, pSource->bCompress ? "application/gzip" : "text/plain; charset=utf-8",
+                     pSource->pAttachments[pSource->current].pName, pSource->bCompress ? ".gz" : "");
 
-    memcpy(ptr, upload_ctx->pBuffer, bytesToCopy);
+            pSource->pPending   = pSource->pPartHeaders;
+            pSource->pendingLen = strlen(pSource->pPartHeaders);
+            pSource->stage      = PAYLOAD_ATTACHMENT;
+        }
+        else if (pSource->stage == PAYLOAD_ATTACHMENT)
+        {
+            const unsigned char *pRaw;
+
+            size_t rawLen = PayloadFill(pSource, &pRaw);
+
+            if (rawLen < PAYLOAD_CHUNK_BYTES)
+            {
+                pSource->stage = ++pSource->current < pSource->attachments ? PAYLOAD_PART : PAYLOAD_TRAILER;
+            }
 
-    upload_ctx->bytesRemaining -= bytesToCopy;
-    upload_ctx->pBuffer        += bytesToCopy;
+            // Base64EncodeWrappedTo writes a NUL after the text, hence the +1
+
+            if (Base64WrappedLength(rawLen) + 1 <= maxCopy - copied)
+            {
+                copied += Base64EncodeWrappedTo(pRaw, rawLen, pOut + copied);
+            }
+            else
+            {
+                pSource->pPending   = pSource->encoded;
+                pSource->pendingLen = Base64EncodeWrappedTo(pRaw, rawLen, pSource->encoded);
+            }
+        }
+        else if (pSource->stage == PAYLOAD_TRAILER)
+        {
+            pSource->pPending   = s_pPayloadTrailer;
+            pSource->pendingLen = strlen(s_pPayloadTrailer);
+            pSource->stage      = PAYLOAD_DONE;
+        }
+        else
+        {
+            break;
+        }
+    }
 
-    return bytesToCopy;
+    return copied;
 }
 
-int SendEmail(const char *pAttachmentName, const char *pAttachment)
+// Every attachment goes in the one message, so a single SMTP session
+
+int SendEmail(const EmailAttachment *pAttachments, int attachments)
 {
-    struct upload_status upload_ctx;
+    PayloadSource *pSource = calloc(1, sizeof(PayloadSource));
+
+    if (!pSource)
+    {
+        return CURLE_OUT_OF_MEMORY;
+    }
+
+    pSource->ppFiles      = calloc(attachments, sizeof(FILE *));
+    pSource->pAttachments = pAttachments;
+    pSource->attachments  = attachments;
+
+    CURLcode res = CURLE_OK;
+
+    for (int attachment=0; attachment<attachments && res == CURLE_OK; attachment++)
+    {
+        if (pAttachments[attachment].pData)
+        {
+            continue;
+        }
+
+        pSource->ppFiles[attachment] = fopen(pAttachments[attachment].pName, "rb");
+
+        if (!pSource->ppFiles[attachment])
+        {
+            fprintf(stderr, "Failure opening attachment %s\n", pAttachments[attachment].pName);
+
+            res = CURLE_READ_ERROR;
+        }
+    }
+
+    pSource->bCompress = g_cmdArgs.bMailCompress && res == CURLE_OK;
+
+    // windowBits 15 + 16 asks zlib for a gzip header and trailer
+
+    if (pSource->bCompress && deflateInit2(&pSource->zStream, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+    {
+        fprintf(stderr, "Failure initialising gzip, sending the attachments uncompressed\n");
+
+        pSource->bCompress = false;
+    }
 
     char gmtDate[100];
     
     GetGMTTime(gmtDate, 100);
 
-    char *pSendBuffer;
-    
-    asprintf(&pSendBuffer, s_pPayloadFormat, gmtDate, g_cmdArgs.pEmailTo, g_cmdArgs.pEmailFrom, g_cmdArgs.pEmailFromName, pAttachment);
-
-    upload_ctx.pBuffer        = pSendBuffer;
-    upload_ctx.bytesRemaining = strlen(pSendBuffer) + 1;
+    asprintf(&pSource->pHeaders, s_pPayloadFormat, gmtDate, g_cmdArgs.pEmailTo, g_cmdArgs.pEmailFrom, g_cmdArgs.pEmailFromName);
 
-    CURL *curl;
-    CURLcode res = CURLE_OK;
+    CURL *curl = NULL;
     struct curl_slist *recipients = NULL;
 
-    curl = curl_easy_init();
+    if (res == CURLE_OK)
+    {
+        curl = curl_easy_init();
+    }
 
     if (curl) 
     {
@@ -297,7 +426,7 @@ int SendEmail(const char *pAttachmentName, const char *pAttachment)
         curl_easy_setopt(curl, CURLOPT_MAIL_RCPT, recipients);
 
         curl_easy_setopt(curl, CURLOPT_READFUNCTION, payload_source);
-        curl_easy_setopt(curl, CURLOPT_READDATA, &upload_ctx);
+        curl_easy_setopt(curl, CURLOPT_READDATA, pSource);
         curl_easy_setopt(curl, CURLOPT_UPLOAD, 1L);
 
         res = curl_easy_perform(curl);
@@ -309,20 +438,87 @@ int SendEmail(const char *pAttachmentName, const char *pAttachment)
         curl_slist_free_all(recipients);
 
         curl_easy_cleanup(curl);
+    }
 
-        free(pSendBuffer);
+    if (pSource->bCompress)
+    {
+        deflateEnd(&pSource->zStream);
+    }
+
+    for (int attachment=0; attachment<attachments; attachment++)
+    {
+        if (pSource->ppFiles[attachment])
+        {
+            fclose(pSource->ppFiles[attachment]);
+        }
     }
 
+    free(pSource->ppFiles);
+
+    FreeString(&pSource->pHeaders);
+    FreeString(&pSource->pPartHeaders);
+
+    free(pSource);
+
     return (int) res;
 }
 
+// A report rendered once by this run and written, mailed and served from the
+// same buffer. Until it's built the file at pPath stands in for it.
+
+typedef struct
+{
+    char         *pPath;
+    ReportBuffer csv;
+    bool         bBuilt;
+} Report;
+
+Report *ReportNew(const char *pPath)
+{
+    Report *pReport = calloc(1, sizeof(Report));
+
+    pReport->pPath = strdup(pPath);
+
+    ReportBufferInit(&pReport->csv, 4096);
+
+    return pReport;
+}
+
+void ReportFree(Report *pReport)
+{
+    ReportBufferFree(&pReport->csv);
+
+    free(pReport->pPath);
+    free(pReport);
+}
+
+int MailReports(GPtrArray *pReports)
+{
+    EmailAttachment *pAttachments = calloc(pReports->len, sizeof(EmailAttachment));
+
+    for (guint report=0; report<pReports->len; report++)
+    {
+        Report *pReport = g_ptr_array_index(pReports, report);
+
+        pAttachments[report].pName   = pReport->pPath;
+        pAttachments[report].pData   = pReport->bBuilt ? pReport->csv.pData : NULL;
+        pAttachments[report].dataLen = pReport->csv.length;
+    }
+
+    int result = SendEmail(pAttachments, pReports->len);
+
+    free(pAttachments);
+
+    return result;
+}
+
 int GetHTTP(const char *pURL, const char *pUserPass, char **pResponse)
 {
     int status = 500;
     
     CURLcode res;
 
-    CURL *pCurl = curl_easy_init();
+    CURL *pCurl = TransportAcquire();
 
     *pResponse = NULL;
 
@@ -345,407 +541,2030 @@ int GetHTTP(const char *pURL, const char *pUserPass, char **pResponse)
             curl_easy_setopt(pCurl, CURLOPT_USERPWD, pUserPass);
         }
         
-        res = curl_easy_perform(pCurl);
+        for (int attempt=1; ; attempt++)
+        {
+            ThrottleWait();
 
-        if (res == CURLE_OK) 
-        {    
-            long responseCode = 0;
+            res = curl_easy_perform(pCurl);
 
-            res = curl_easy_getinfo(pCurl, CURLINFO_RESPONSE_CODE, &responseCode);
+            if (res == CURLE_OK) 
+            {    
+                TransportCount(pCurl);
 
-            if (res == CURLE_OK)
-            {
-                if (responseCode == 200)
+                long responseCode = 0;
+
+                res = curl_easy_getinfo(pCurl, CURLINFO_RESPONSE_CODE, &responseCode);
+
+                if (res == CURLE_OK)
                 {
-                    *pResponse = s.pCharData;
+                    status = responseCode;
                 }
+            } 
+
+            MetricsRecordRequest(pCurl, res == CURLE_OK ? status : 0);
 
-                status = responseCode;
+            if (!ThrottleComplete(pCurl, status) || attempt == THROTTLE_MAX_ATTEMPTS)
+            {
+                break;
             }
-        } 
 
-        if (status != 200)
+            FreeString(&s.pCharData);
+
+            InitResponseString(&s);
+
+            status = 500;
+        }
+
+        if (status == 200)
+        {
+            *pResponse = s.pCharData;
+        }
+        else
         {
             free(s.pCharData);
         }               
   
-        curl_easy_cleanup(pCurl);
+        TransportRelease(pCurl);
     }
 
     return status;
 }
 
-bool GetJSONString(json_t *pObject, char **pValue, const char *pName)
+typedef struct
 {
-   json_t *pJSONString = json_object_get(pObject, pName);
+    CURL               *pCurl;
+    curl_write_callback pWrite;
+    void               *pWriteData;
+    bool               bChecked, bAccepted;
+} StreamContext;
 
-   if (pJSONString)
-   {
-      const char *pJSONValue = json_string_value(pJSONString);
-
-      if (pJSONValue)
-      {
-         *pValue = strdup(pJSONValue);
-
-         return true;
-      }
-   }
-
-   return false;
-}
-
-bool ExtractString(const char *pSource, const char *pLeft, const char *pRight, char **pExtract)
-{    
-    size_t leftLen = strlen(pLeft);
-
-    char *pLeftFound = strstr(pSource, pLeft);
-
-    if (pLeftFound)
-    {
-        char *pRightRound = strstr(pLeftFound, pRight);
-
-        if (pRightRound)
-        {
-            size_t extractLen = pRightRound - pLeftFound - leftLen;
-
-            *pExtract = calloc(extractLen + 1, 1);
-
-            strncpy(*pExtract, pLeftFound + leftLen, extractLen);
-
-            return true;
-        }
-    }
-
-    return false;
-}
-
-bool g_bLowDayArmed = false;
-bool g_bDone = false;
-
-void LogDigits(GHashTable *pKeyMap, const char *pDigits, int day)
+static size_t StreamWrite(char *ptr, size_t size, size_t nmemb, void *pUserData)
 {
-    int digit = atoi(pDigits);
-
-    char *pTrimmedDigit = NULL;
+    StreamContext *pStream = (StreamContext *) pUserData;
 
-    asprintf(&pTrimmedDigit, "%d", digit);
-
-    int *pCount = g_hash_table_lookup(pKeyMap, pTrimmedDigit);
-
-    if (!pCount)
+    if (!pStream->bChecked)
     {
-        pCount = (int *) calloc(32, sizeof(int));                                                            
+        long responseCode = 0;
 
-        g_hash_table_insert(pKeyMap, strdup(pTrimmedDigit), pCount);
+        curl_easy_getinfo(pStream->pCurl, CURLINFO_RESPONSE_CODE, &responseCode);
+
+        pStream->bChecked  = true;
+        pStream->bAccepted = responseCode == 200;
     }
 
-    if (day > 0 || day < 32)
+    if (pStream->bAccepted)
     {
-        pCount[day]++;
-        pCount[0]++;
+        return pStream->pWrite(ptr, size, nmemb, pStream->pWriteData);
     }
 
-    FreeString(&pTrimmedDigit);
+    return size * nmemb;
 }
 
-json_t *g_pResponseArray;
+// Same as GetHTTP but hands the body to pWrite as it arrives, only for 200 responses
 
-void GetReport(const char *pURI, const char *pUserPass, char **pNextURI, GHashTable *pKeyMap)
+int GetHTTPStream(const char *pURL, const char *pUserPass, curl_write_callback pWrite, void *pWriteData)
 {
-    char *pURL;
-
-    asprintf(&pURL, "https://api.twilio.com%s", pURI);
-
-    char *pResponse = NULL;
-
-    fprintf(stderr, "%s\n%s\n", pURL, pUserPass);
-
-    int statusCode = GetHTTP(pURL, pUserPass, &pResponse);
+    int status = 500;
 
-    free(pURL);
+    CURL *pCurl = TransportAcquire();
 
-    if (statusCode != 200)
+    if (pCurl)
     {
-        return;
-    }
+        StreamContext stream = { pCurl, pWrite, pWriteData, false, false };
 
-    json_error_t err;
-
-    json_t *pReport = json_loads(pResponse, 0, &err);
+        curl_easy_setopt(pCurl, CURLOPT_URL, pURL);
+        curl_easy_setopt(pCurl, CURLOPT_WRITEFUNCTION, StreamWrite);
+        curl_easy_setopt(pCurl, CURLOPT_WRITEDATA, &stream);
 
-    if (pReport)
-    {
-        GetJSONString(pReport, pNextURI, "next_page_uri");
+        // A long listing page may take a while to arrive, only give up on a
+        // connection that stops delivering
 
-        json_t *pCallsArray = json_object_get(pReport, "calls");
+        curl_easy_setopt(pCurl, CURLOPT_CONNECTTIMEOUT_MS, 4000L);
+        curl_easy_setopt(pCurl, CURLOPT_LOW_SPEED_LIMIT,   1L);
+        curl_easy_setopt(pCurl, CURLOPT_LOW_SPEED_TIME,    30L);
 
-        if (pCallsArray)
+        if (pUserPass)
         {
-            int arraySize = json_array_size(pCallsArray);
-
-            for (int index=0; index<arraySize && !g_bDone; index++)
-            {
-                json_t *pCallJSON = json_array_get(pCallsArray, index);
+            curl_easy_setopt(pCurl, CURLOPT_USERPWD, pUserPass);
+        }
 
-                if (pCallJSON)
-                {
-                    char *pSID      = NULL; 
-                    char *pTo       = NULL; 
-                    char *pFrom     = NULL;
-                    char *pStart    = NULL; 
-                    char *pEnd      = NULL;
-                    char *pDuration = NULL;
-
-                    if (GetJSONString(pCallJSON, &pSID,      "sid") &&
-                        GetJSONString(pCallJSON, &pFrom,     "from_formatted") &&
-                        GetJSONString(pCallJSON, &pTo,       "to_formatted") &&
-                        GetJSONString(pCallJSON, &pStart,    "start_time") &&
-                        GetJSONString(pCallJSON, &pEnd,      "end_time") &&
-                        GetJSONString(pCallJSON, &pDuration, "duration"))
-                    {
-                        if (strlen(pStart) > 26)
-                        {                                                                                   ;
-                            pStart[7] = 0;
+        // Throttled responses never reach pWrite so the request can simply be repeated
 
-                            int day = atoi(&pStart[5]);
+        for (int attempt=1; ; attempt++)
+        {
+            ThrottleWait();
 
-                            char *pEventsURL;
+            stream.bChecked = false;
 
-                            asprintf(&pEventsURL, "https://api.twilio.com/2010-04-01/Accounts/AC5b4731b15db3d93a9f93b72ebeece5ea/Calls/%s/Events.json", pSID);
+            CURLcode res = curl_easy_perform(pCurl);
 
-                            char *pEventsResponse = NULL;
+            if (res == CURLE_OK)
+            {
+                TransportCount(pCurl);
 
-                            int eventsStatusCode = GetHTTP(pEventsURL, "AC5b4731b15db3d93a9f93b72ebeece5ea:38b6e0a6c0332e4d54a6680bc944f78c", &pEventsResponse);
+                long responseCode = 0;
 
-                            free(pEventsURL);
+                if (curl_easy_getinfo(pCurl, CURLINFO_RESPONSE_CODE, &responseCode) == CURLE_OK)
+                {
+                    status = responseCode;
+                }
+            }
 
-                            if (eventsStatusCode == 200)
-                            {                    
-                                json_error_t err;
+            MetricsRecordRequest(pCurl, res == CURLE_OK ? status : 0);
 
-                                json_t *pResponseJSON = json_loads(pEventsResponse, 0, &err);
+            if (!ThrottleComplete(pCurl, status) || attempt == THROTTLE_MAX_ATTEMPTS)
+            {
+                break;
+            }
 
-                                if (pResponseJSON)
-                                {
-                                    json_array_append(g_pResponseArray, pResponseJSON);
+            status = 500;
+        }
 
-                                    json_t *pEventsJSON = json_object_get(pResponseJSON, "events");
+        TransportRelease(pCurl);
+    }
 
-                                    if (pEventsJSON)
-                                    {
-                                        int arraySize = json_array_size(pEventsJSON);
+    return status;
+}
+
+bool GetJSONString(json_t *pObject, char **pValue, const char *pName)
+{
+   json_t *pJSONString = json_object_get(pObject, pName);
+
+   if (pJSONString)
+   {
+      const char *pJSONValue = json_string_value(pJSONString);
+
+      if (pJSONValue)
+      {
+         *pValue = strdup(pJSONValue);
+
+         return true;
+      }
+   }
+
+   return false;
+}
+
+bool g_bLowDayArmed = false;
+volatile bool g_bDone = false;
+
+// atoi over a view, which isn't NUL terminated
+
+int DigitsKey(const MatchView *pDigits)
+{
+    const char *pChar = pDigits->pStart;
+    const char *pEnd  = pDigits->pStart + pDigits->length;
+
+    while (pChar < pEnd && isspace((unsigned char) *pChar))
+    {
+        pChar++;
+    }
+
+    bool bNegative = pChar < pEnd && *pChar == '-';
+
+    if (pChar < pEnd && (*pChar == '-' || *pChar == '+'))
+    {
+        pChar++;
+    }
+
+    unsigned int key = 0;
+
+    while (pChar < pEnd && isdigit((unsigned char) *pChar))
+    {
+        key = key * 10 + (*pChar++ - '0');
+    }
+
+    return bNegative ? -(int) key : (int) key;
+}
+
+void LogDigits(KeyTable *pKeyMap, const MatchView *pDigits, int day)
+{
+    KeyTableAdd(pKeyMap, DigitsKey(pDigits), day);
+}
+
+Matcher    *g_pMatcher    = NULL;
+DumpWriter *g_pDump       = NULL;
+EventCache *g_pEventCache = NULL;
+WorkPool   *g_pParsePool  = NULL;
+
+// Events.json bodies one parse worker holds at once
+
+#define PARSE_DEPTH 32
+
+// Credentials, listing queue and results for one account, batch mode runs
+// several of these over the same fetch engine
+
+typedef struct
+{
+    char       *pAccount, *pAPIKey;
+    char       *pUserPass;
+    KeyTable   *pKeyMap;
+    KeyTable   **ppShards;
+    Checkpoint *pCheckpoint;
+    CallStore  *pStore;
+    CallQueue  *pQueue;
+    gint       activeShards;
+    bool       bDrained;
+
+    struct ListingContext *pListings;
+    GThread               **ppListingThreads;
+    int                   shards;
+} Account;
+
+// An Events.json response on its way through parsing. The parse fields are
+// filled on a parse worker, everything else happens on the fetch thread.
+
+typedef struct
+{
+    Account    *pAccount;
+    CallRecord *pRecord;
+    int        day;
+    time_t     startTime;
+    bool       bCached;
+
+    const char *pResponse;
+    size_t     responseLen;
+    MatchView  digits;
+    int        key;
+    bool       bAccepted, bEvents, bFound;
+    double     parseSeconds, aggregateSeconds;
+} EventsContext;
+
+void ShowMatch(const MatchView *pDigits, int day, const char *pSID)
+{
+    fprintf(stderr, "%02d,%.*s,%s\n", day, (int) pDigits->length, pDigits->pStart, pSID);
+}
+
+// Counts the number heard on a call, Invalid when pDigits is NULL
+
+void LogMatch(KeyTable *pKeyMap, const MatchView *pDigits, int day)
+{
+    if (pDigits)
+    {
+        LogDigits(pKeyMap, pDigits, day);
+    }
+    else
+    {
+        KeyTableAdd(pKeyMap, KEY_TABLE_INVALID, day);
+    }
+}
+
+// Finds the first number heard across the events of one call
+
+bool MatchEvents(json_t *pResponseJSON, MatchView *pDigits)
+{
+    json_t *pEventsJSON = json_object_get(pResponseJSON, "events");
+
+    int arraySize = json_array_size(pEventsJSON);
+
+    for (int index=0; index<arraySize; index++)
+    {
+        json_t *pEventJSON = json_array_get(pEventsJSON, index);
+
+        if (pEventJSON)
+        {
+            json_t *pResponseJSON = json_object_get(pEventJSON, "response");
+
+            if (pResponseJSON)
+            {
+                json_t *pBodyJSON = json_object_get(pResponseJSON, "response_body");
+
+                const char *pResponseBody = json_string_value(pBodyJSON);
+
+                if (pResponseBody)
+                {
+                    if (MatcherFind(g_pMatcher, pResponseBody, json_string_length(pBodyJSON), pDigits) >= 0)
+                    {
+                        return true;
+                    }
+                }
+            }
+        }
+    }
+
+    return false;
+}
+
+// Logs the first number heard across the events of one call, or Invalid
+
+void LogEvents(json_t *pResponseJSON, KeyTable *pKeyMap, int day, const char *pSID)
+{
+    if (!json_object_get(pResponseJSON, "events"))
+    {
+        return;
+    }
+
+    MatchView digits;
+
+    bool bFound = MatchEvents(pResponseJSON, &digits);
+
+    if (bFound)
+    {
+        ShowMatch(&digits, day, pSID);
+    }
+
+    LogMatch(pKeyMap, bFound ? &digits : NULL, day);
+}
+
+// Parses one response and counts it in the worker's shard of the account, or
+// straight into the account's table when worker is -1. Only the response
+// bodies are decoded, the full parser is left to decide on anything the
+// scanner doesn't understand.
+
+void ParseEvents(void *pItem, int worker, void *pUserData)
+{
+    EventsContext *pContext = (EventsContext *) pItem;
+
+    double parseStart = MetricsNow();
+
+    EventScanResult result = EventScan(pContext->pResponse, pContext->responseLen, g_pMatcher, &pContext->pRecord->arena, &pContext->digits);
+
+    json_t *pResponseJSON = NULL;
+
+    if (result == EVENT_SCAN_MALFORMED)
+    {
+        json_error_t err;
+
+        pResponseJSON = json_loads(pContext->pResponse, 0, &err);
+    }
+
+    double aggregateStart = MetricsNow();
+
+    pContext->parseSeconds = aggregateStart - parseStart;
+    pContext->bAccepted    = result != EVENT_SCAN_MALFORMED || pResponseJSON;
+    pContext->bEvents      = pResponseJSON ? json_object_get(pResponseJSON, "events") != NULL : pContext->bAccepted && result != EVENT_SCAN_NO_EVENTS;
+
+    if (pContext->bEvents)
+    {
+        pContext->bFound = pResponseJSON ? MatchEvents(pResponseJSON, &pContext->digits) : result == EVENT_SCAN_FOUND;
+
+        // Digits found in the DOM go away with it
+
+        if (pContext->bFound && pResponseJSON)
+        {
+            pContext->digits.pStart = ArenaStrndup(&pContext->pRecord->arena, pContext->digits.pStart, pContext->digits.length);
+        }
+
+        KeyTable *pKeyMap = worker < 0 ? pContext->pAccount->pKeyMap : pContext->pAccount->ppShards[worker];
+
+        pContext->key = pContext->bFound ? DigitsKey(&pContext->digits) : KEY_TABLE_INVALID;
+
+        KeyTableAdd(pKeyMap, pContext->key, pContext->day);
+
+        pContext->aggregateSeconds = MetricsNow() - aggregateStart;
+    }
+
+    if (pResponseJSON)
+    {
+        json_decref(pResponseJSON);
+    }
+}
+
+// Back on the fetch thread, everything shared is updated here so the workers
+// never take a lock
+
+void FinishEvents(void *pItem, int worker, void *pUserData)
+{
+    EventsContext *pContext = (EventsContext *) pItem;
+
+    MetricsRecordStage(METRIC_STAGE_EVENTS_PARSE, pContext->parseSeconds);
+
+    if (pContext->bAccepted)
+    {
+        if (g_pEventCache && !pContext->bCached)
+        {
+            EventCacheStore(g_pEventCache, pContext->pRecord->pSID, pContext->pResponse, pContext->responseLen);
+        }
+
+        if (g_pDump)
+        {
+            DumpWrite(g_pDump, pContext->pRecord->pSID, pContext->startTime, pContext->day, pContext->pResponse, pContext->responseLen);
+        }
+    }
+    else if (pContext->pAccount->pCheckpoint)
+    {
+        CheckpointFail(pContext->pAccount->pCheckpoint, pContext->startTime);
+    }
+
+    if (pContext->bEvents)
+    {
+        if (pContext->bFound)
+        {
+            ShowMatch(&pContext->digits, pContext->day, pContext->pRecord->pSID);
+        }
+
+        if (pContext->pAccount->pCheckpoint)
+        {
+            CheckpointMark(pContext->pAccount->pCheckpoint, pContext->pRecord->pSID, pContext->startTime);
+        }
+
+        if (pContext->pAccount->pStore)
+        {
+            CallStoreAppend(pContext->pAccount->pStore, pContext->pRecord->pSID, pContext->startTime, pContext->day, pContext->key,
+                            pContext->pRecord->pDuration ? atoi(pContext->pRecord->pDuration) : 0);
+        }
+
+        MetricsRecordStage(METRIC_STAGE_AGGREGATE, pContext->aggregateSeconds);
+    }
+
+    // The context lives in the record's arena
+
+    CallRecordFree(pContext->pRecord);
+}
+
+// Drops a call whose events couldn't be fetched, the checkpoint won't resume
+// past its day so the next run retries it
+
+void DropEvents(EventsContext *pContext)
+{
+    if (pContext->pAccount->pCheckpoint)
+    {
+        CheckpointFail(pContext->pAccount->pCheckpoint, pContext->startTime);
+    }
+
+    CallRecordFree(pContext->pRecord);
+}
+
+void ProcessEvents(int statusCode, const char *pEventsResponse, void *pUserData)
+{
+    EventsContext *pContext = (EventsContext *) pUserData;
+
+    if (statusCode != 200)
+    {
+        DropEvents(pContext);
+        return;
+    }
+
+    pContext->pResponse   = pEventsResponse;
+    pContext->responseLen = strlen(pEventsResponse);
+
+    if (!g_pParsePool)
+    {
+        ParseEvents(pContext, -1, NULL);
+        FinishEvents(pContext, -1, NULL);
+        return;
+    }
+
+    // The engine frees its response once this returns, cached ones already
+    // live in the record's arena
+
+    if (!pContext->bCached)
+    {
+        pContext->pResponse = ArenaStrndup(&pContext->pRecord->arena, pEventsResponse, pContext->responseLen);
+    }
+
+    if (!pContext->pResponse)
+    {
+        DropEvents(pContext);
+        return;
+    }
+
+    WorkPoolSubmit(g_pParsePool, pContext);
+}
+
+void ProcessCall(CallRecord *pRecord, Account *pAccount, FetchEngine *pEngine)
+{
+    if (pAccount->pCheckpoint && CheckpointSeen(pAccount->pCheckpoint, pRecord->pSID))
+    {
+        CallRecordFree(pRecord);
+        return;
+    }
+
+    if (strlen(pRecord->pStart) > 26)
+    {
+        time_t startTime = ParseCallTime(pRecord->pStart);
+
+        pRecord->pStart[7] = 0;
+
+        EventsContext *pContext = ArenaAlloc(&pRecord->arena, sizeof(EventsContext));
+
+        if (!pContext)
+        {
+            if (pAccount->pCheckpoint)
+            {
+                CheckpointFail(pAccount->pCheckpoint, startTime);
+            }
+
+            CallRecordFree(pRecord);
+            return;
+        }
+
+        pContext->pAccount = pAccount;
+        pContext->pRecord  = pRecord;
+        pContext->day     = atoi(&pRecord->pStart[5]);
+        pContext->startTime = startTime;
+        pContext->bCached   = false;
+
+        if (g_pEventCache)
+        {
+            char *pCachedResponse = EventCacheLookup(g_pEventCache, pRecord->pSID, &pRecord->arena);
+
+            if (pCachedResponse)
+            {
+                pContext->bCached = true;
+
+                ProcessEvents(200, pCachedResponse, pContext);
+                return;
+            }
+        }
+
+        char *pEventsURL = ArenaPrintf(&pRecord->arena, "%s/2010-04-01/Accounts/%s/Calls/%s/Events.json", g_cmdArgs.pBaseURL, pAccount->pAccount, pRecord->pSID);
+
+        if (!pEventsURL)
+        {
+            DropEvents(pContext);
+            return;
+        }
+
+        FetchEngineSubmit(pEngine, pEventsURL, pAccount->pUserPass, ProcessEvents, pContext);
+
+        //Log("%s,%s,%s,%s,%s,%s", pFrom, pTo, pStart, pEnd, pDuration, digits);
+    }
+    else
+    {
+        CallRecordFree(pRecord);
+    }
+}
+
+// Calls that don't fit in a full call queue wait in the page backlog, the
+// transfer is never held up by a slow consumer. The backlog is bounded by the
+// page size and is pushed once the page has arrived.
+
+typedef struct
+{
+    CallParser parser;
+    CallQueue  *pQueue;
+    GPtrArray  *pBacklog;
+    double     parseSeconds;
+} ListingPage;
+
+void QueueCall(CallRecord *pRecord, void *pUserData)
+{
+    ListingPage *pPage = (ListingPage *) pUserData;
+
+    bool bClosed = false;
+
+    if (g_bDone)
+    {
+        CallRecordFree(pRecord);
+    }
+    else if (pPage->pBacklog->len > 0 || !CallQueueTryPush(pPage->pQueue, pRecord, &bClosed))
+    {
+        if (bClosed)
+        {
+            CallRecordFree(pRecord);
+        }
+        else
+        {
+            g_ptr_array_add(pPage->pBacklog, pRecord);
+        }
+    }
+}
+
+static size_t ListingPageWrite(char *ptr, size_t size, size_t nmemb, void *pUserData)
+{
+    ListingPage *pPage = (ListingPage *) pUserData;
+
+    double writeStart = MetricsNow();
+
+    size_t written = CallParserWrite(ptr, size, nmemb, &pPage->parser);
+
+    pPage->parseSeconds += MetricsNow() - writeStart;
+
+    return written;
+}
+
+// Lists one page, false when it failed or arrived truncated. The calls parsed
+// before a failure are still queued.
+
+bool GetReport(Arena *pPageArena, const char *pURI, const char *pUserPass, char **pNextURI, CallQueue *pQueue)
+{
+    char *pURL = ArenaPrintf(pPageArena, "%s%s", g_cmdArgs.pBaseURL, pURI);
+
+    fprintf(stderr, "%s\n", pURL);
+
+    double pageStart = MetricsNow();
+
+    ListingPage page = { .pQueue = pQueue, .pBacklog = g_ptr_array_new() };
+
+    CallParserInit(&page.parser, QueueCall, &page);
+
+    int statusCode = GetHTTPStream(pURL, pUserPass, ListingPageWrite, &page);
+
+    bool bComplete = !g_bDone && statusCode == 200 && CallParserDone(&page.parser);
+
+    if (bComplete)
+    {
+        *pNextURI            = page.parser.pNextURI;
+        page.parser.pNextURI = NULL;
+    }
+    else if (!g_bDone && statusCode != 200)
+    {
+        fprintf(stderr, "Failure listing %s, status %d\n", pURL, statusCode);
+    }
+    else if (!g_bDone)
+    {
+        fprintf(stderr, "Failure listing %s, page truncated\n", pURL);
+    }
+
+    CallParserCleanup(&page.parser);
+
+    for (guint index=0; index<page.pBacklog->len; index++)
+    {
+        CallRecord *pRecord = g_ptr_array_index(page.pBacklog, index);
+
+        if (g_bDone || !CallQueuePush(pQueue, pRecord))
+        {
+            CallRecordFree(pRecord);
+        }
+    }
+
+    g_ptr_array_free(page.pBacklog, TRUE);
+
+    MetricsRecordStage(METRIC_STAGE_LIST_PAGE,  MetricsNow() - pageStart);
+    MetricsRecordStage(METRIC_STAGE_LIST_PARSE, page.parseSeconds);
+
+    return bComplete;
+}
+
+// bComplete is set once the shard has listed its last page
+
+typedef struct ListingContext
+{
+    char    *pURL;
+    Account *pAccount;
+    time_t  startTime;
+    bool    bComplete;
+} ListingContext;
+
+gpointer ListingThread(gpointer pData)
+{
+    ListingContext *pListing = (ListingContext *) pData;
+
+    char *pNextURL = NULL;    
+
+    Arena pageArena;
+
+    ArenaInit(&pageArena, 4096);
+    
+    while (!g_bDone)
+    {
+        pNextURL = NULL;
+
+        bool bPage = GetReport(&pageArena, pListing->pURL, pListing->pAccount->pUserPass, &pNextURL, pListing->pAccount->pQueue);
+
+        ArenaReset(&pageArena);
+        
+        if (!bPage || !pNextURL)
+        {
+            pListing->bComplete = bPage;
+            break;
+        }
+        
+        free(pListing->pURL);
+        pListing->pURL = pNextURL;        
+    }
+
+    ArenaFree(&pageArena);
+
+    FreeString(&pListing->pURL);
+
+    // The last shard of the account to finish closes its queue
+
+    if (g_atomic_int_dec_and_test(&pListing->pAccount->activeShards))
+    {
+        CallQueueClose(pListing->pAccount->pQueue);
+    }
+
+    return NULL;
+}
+
+time_t ParseDate(const char *pDate)
+{
+    struct tm date;
+
+    memset(&date, 0, sizeof(date));
+
+    if (!strptime(pDate, "%Y-%m-%d", &date))
+    {
+        return 0;
+    }
+
+    return timegm(&date);
+}
+
+// Splits the listing window into whole day shards. Inner shards are bounded on
+// StartTime alone so a call running past midnight is listed by exactly one
+// shard, the last keeps the original EndTime bound. *ppStartTimes holds the
+// first day of each shard.
+
+int ShardListing(const char *pAccount, const char *pStartDate, const char *pEndDate, int shards, char ***pppURLs, time_t **ppStartTimes)
+{
+    time_t startDay = ParseDate(pStartDate);
+    time_t endDay   = ParseDate(pEndDate);
+
+    int days = startDay && endDay && endDay >= startDay ? (int) ((endDay - startDay) / 86400) + 1 : 1;
+
+    if (shards < 1)
+    {
+        shards = 1;
+    }
+
+    if (shards > days)
+    {
+        shards = days;
+    }
+
+    char   **ppURLs     = calloc(shards, sizeof(char *));
+    time_t *pStartTimes = calloc(shards, sizeof(time_t));
+
+    for (int shard=0; shard<shards; shard++)
+    {
+        char shardStart[32], shardEnd[32];
+
+        time_t firstDay = startDay + (time_t) (days * shard / shards) * 86400;
+        time_t lastDay  = startDay + (time_t) (days * (shard + 1) / shards - 1) * 86400;
+
+        pStartTimes[shard] = firstDay;
+
+        struct tm firstTime = *gmtime(&firstDay);
+        struct tm lastTime  = *gmtime(&lastDay);
+
+        strftime(shardStart, sizeof(shardStart), "%Y-%m-%d", &firstTime);
+        strftime(shardEnd,   sizeof(shardEnd),   "%Y-%m-%d", &lastTime);
+
+        if (shards == 1)
+        {
+            snprintf(shardStart, sizeof(shardStart), "%s", pStartDate);
+            snprintf(shardEnd,   sizeof(shardEnd),   "%s", pEndDate);
+        }
+
+        asprintf(&ppURLs[shard], "/2010-04-01/Accounts/%s/Calls.json?StartTime>=%sT00:00:00-00:00&%s<=%sT23:59:59-00:00", 
+                 pAccount, shardStart, shard == shards - 1 ? "EndTime" : "StartTime", shardEnd);
+    }
+
+    *pppURLs      = ppURLs;
+    *ppStartTimes = pStartTimes;
+
+    return shards;
+}
+
+// Loads the account's checkpoint and starts a listing thread per shard.
+// Batch runs keep one checkpoint per account next to the configured path.
+// Service mode keeps the checkpoint resident between polls, in memory only
+// when no path is configured, so each poll lists from the day of the last
+// call counted with nothing missed before it.
+
+void StartListing(Account *pAccount, bool bBatch, const char *pEndDate)
+{
+    char resumeDate[32];
+
+    snprintf(resumeDate, sizeof(resumeDate), "%s", g_cmdArgs.pStartDate);
+
+    if (!pAccount->pCheckpoint && (g_cmdArgs.pCheckpointPath || g_cmdArgs.servePort))
+    {
+        char *pCheckpointPath = NULL;
+
+        if (g_cmdArgs.pCheckpointPath)
+        {
+            asprintf(&pCheckpointPath, bBatch ? "%s.%s" : "%s", g_cmdArgs.pCheckpointPath, pAccount->pAccount);
+        }
+
+        pAccount->pCheckpoint = CheckpointLoad(pCheckpointPath, pAccount->pAccount, g_cmdArgs.pStartDate, pAccount->pKeyMap);
+
+        free(pCheckpointPath);
+    }
+
+    if (pAccount->pCheckpoint)
+    {
+        CheckpointResumeDate(pAccount->pCheckpoint, g_cmdArgs.pStartDate, resumeDate, sizeof(resumeDate));
+    }
+
+    if (g_cmdArgs.pStorePath && !pAccount->pStore)
+    {
+        pAccount->pStore = CallStoreOpen(g_cmdArgs.pStorePath, pAccount->pAccount);
+    }
+
+    char   **ppURLs;
+    time_t *pStartTimes;
+
+    asprintf(&pAccount->pUserPass, "%s:%s", pAccount->pAccount, pAccount->pAPIKey);
+
+    int shards = ShardListing(pAccount->pAccount, resumeDate, pEndDate, g_cmdArgs.listShards, &ppURLs, &pStartTimes);
+
+    pAccount->pQueue           = CallQueueNew(g_cmdArgs.listDepth);
+    pAccount->activeShards     = shards;
+    pAccount->bDrained         = false;
+    pAccount->shards           = shards;
+    pAccount->pListings        = calloc(shards, sizeof(ListingContext));
+    pAccount->ppListingThreads = calloc(shards, sizeof(GThread *));
+
+    for (int shard=0; shard<shards; shard++)
+    {
+        pAccount->pListings[shard] = (ListingContext) { ppURLs[shard], pAccount, pStartTimes[shard] };
+
+        pAccount->ppListingThreads[shard] = g_thread_new("listing", ListingThread, &pAccount->pListings[shard]);
+    }
+
+    free(ppURLs);
+    free(pStartTimes);
+}
+
+// Joins the listing threads, false unless every shard listed its last page.
+// The checkpoint won't resume past the first day of a shard that didn't.
+
+bool FinishListing(Account *pAccount)
+{
+    bool bComplete = true;
+
+    for (int shard=0; shard<pAccount->shards; shard++)
+    {
+        ListingContext *pListing = &pAccount->pListings[shard];
+
+        g_thread_join(pAccount->ppListingThreads[shard]);
+
+        if (!pListing->bComplete && pAccount->pCheckpoint)
+        {
+            CheckpointFail(pAccount->pCheckpoint, pListing->startTime);
+        }
+
+        bComplete = bComplete && pListing->bComplete;
+    }
+
+    free(pAccount->ppListingThreads);
+    free(pAccount->pListings);
+
+    pAccount->ppListingThreads = NULL;
+    pAccount->pListings        = NULL;
+
+    CallQueueFree(pAccount->pQueue);
+
+    pAccount->pQueue = NULL;
+
+    if (pAccount->pCheckpoint)
+    {
+        fprintf(stderr, "Checkpoint : %s %ld calls skipped, %ld new%s\n", pAccount->pAccount, pAccount->pCheckpoint->skipped, pAccount->pCheckpoint->marked,
+                pAccount->pCheckpoint->bFailed ? ", resume held back" : "");
+
+        CheckpointAdvance(pAccount->pCheckpoint);
+        CheckpointSave(pAccount->pCheckpoint, pAccount->pKeyMap);
+
+        pAccount->pCheckpoint->skipped = 0;
+        pAccount->pCheckpoint->marked  = 0;
+
+        if (!g_cmdArgs.servePort)
+        {
+            CheckpointFree(pAccount->pCheckpoint);
+
+            pAccount->pCheckpoint = NULL;
+        }
+    }
+
+    if (pAccount->pStore)
+    {
+        CallStoreFlush(pAccount->pStore);
+    }
+
+    FreeString(&pAccount->pUserPass);
+
+    return bComplete;
+}
+
+// Takes the next listed call round robin across the accounts so one large
+// account can't starve the rest of the fetch engine. NULL once every account
+// has been drained.
+
+#define CALL_POLL_MS 5
+
+CallRecord *NextCall(Account *pAccounts, int accounts, FetchEngine *pEngine, int *pNext, Account **ppAccount)
+{
+    while (1)
+    {
+        int open = 0;
+
+        Account *pOpen = NULL;
+
+        for (int tries=0; tries<accounts; tries++)
+        {
+            Account *pAccount = &pAccounts[*pNext];
+
+            *pNext = (*pNext + 1) % accounts;
+
+            if (pAccount->bDrained)
+            {
+                continue;
+            }
+
+            bool bClosed = false;
+
+            CallRecord *pRecord = CallQueueTryPop(pAccount->pQueue, &bClosed);
+
+            if (pRecord)
+            {
+                *ppAccount = pAccount;
+                return pRecord;
+            }
+
+            if (bClosed)
+            {
+                pAccount->bDrained = true;
+                continue;
+            }
+
+            open++;
+            pOpen = pAccount;
+        }
+
+        if (open == 0)
+        {
+            return NULL;
+        }
+
+        if (!FetchEngineIdle(pEngine))
+        {
+            FetchEngineWait(pEngine, 10);
+        }
+        else if (open == 1)
+        {
+            // Nothing in flight and a single listing left, so just wait on it
+
+            CallRecord *pRecord = CallQueuePop(pOpen->pQueue);
+
+            if (pRecord)
+            {
+                *ppAccount = pOpen;
+                return pRecord;
+            }
+
+            pOpen->bDrained = true;
+        }
+        else
+        {
+            g_usleep(CALL_POLL_MS * 1000);
+        }
+    }
+}
+
+// The dump and the events cache stay open across every fetch of the run
+
+void OpenStores()
+{
+    if (g_cmdArgs.pDumpPath && *g_cmdArgs.pDumpPath)
+    {
+        char *pDumpPath;
+
+        bool bAddSuffix = g_cmdArgs.bDumpCompress && !g_str_has_suffix(g_cmdArgs.pDumpPath, ".gz");
+
+        asprintf(&pDumpPath, bAddSuffix ? "%s.gz" : "%s", g_cmdArgs.pDumpPath);
+
+        g_pDump = DumpOpen(pDumpPath, g_cmdArgs.bDumpCompress, (uint64_t) g_cmdArgs.dumpMB << 20);
+
+        free(pDumpPath);
+    }
+
+    if (g_cmdArgs.pCacheDir)
+    {
+        g_pEventCache = EventCacheOpen(g_cmdArgs.pCacheDir, (uint64_t) g_cmdArgs.cacheMB << 20, g_cmdArgs.cacheEntries);
+    }
+}
+
+void CloseStores()
+{
+    if (g_pEventCache)
+    {
+        EventCacheShowStats(g_pEventCache);
+        EventCacheClose(g_pEventCache);
+
+        g_pEventCache = NULL;
+    }
+
+    DumpClose(g_pDump);
+
+    g_pDump = NULL;
+}
+
+// Parse workers count into a shard of each account's table, merged into the
+// table once every response has been through
+
+void StartParsing(Account *pAccounts, int accounts)
+{
+    if (g_cmdArgs.parseWorkers < 1)
+    {
+        return;
+    }
+
+    for (int account=0; account<accounts; account++)
+    {
+        pAccounts[account].ppShards = calloc(g_cmdArgs.parseWorkers, sizeof(KeyTable *));
+
+        for (int worker=0; worker<g_cmdArgs.parseWorkers; worker++)
+        {
+            pAccounts[account].ppShards[worker] = KeyTableNew();
+        }
+    }
+
+    g_pParsePool = WorkPoolNew(g_cmdArgs.parseWorkers, PARSE_DEPTH, ParseEvents, FinishEvents, NULL);
+}
+
+void FinishParsing(Account *pAccounts, int accounts)
+{
+    if (!g_pParsePool)
+    {
+        return;
+    }
+
+    WorkPoolFree(g_pParsePool);
+
+    g_pParsePool = NULL;
+
+    for (int account=0; account<accounts; account++)
+    {
+        for (int worker=0; worker<g_cmdArgs.parseWorkers; worker++)
+        {
+            KeyTableMerge(pAccounts[account].pKeyMap, pAccounts[account].ppShards[worker]);
+            KeyTableFree(pAccounts[account].ppShards[worker]);
+        }
+
+        free(pAccounts[account].ppShards);
+
+        pAccounts[account].ppShards = NULL;
+    }
+}
+
+// Over the memory budget the checkpoint SIDs, the only state that grows with
+// the number of calls, are spilled to disk and the freed heap is handed back
+// to the system. Each spill rewrites the account's spill file, so an account
+// is only spilled once it holds a fair share of that file in memory.
+
+#define MEMORY_CHECK_CALLS 1024
+#define SPILL_MIN_SIDS     4096
+
+void KeepMemoryBudget(Account *pAccounts, int accounts)
+{
+    size_t rss = MetricsRSS();
+
+    if (rss <= (size_t) g_cmdArgs.memoryMB << 20)
+    {
+        return;
+    }
+
+    long spilled = 0;
+
+    for (int account=0; account<accounts; account++)
+    {
+        Checkpoint *pCheckpoint = pAccounts[account].pCheckpoint;
+
+        if (!pCheckpoint)
+        {
+            continue;
+        }
+
+        long memorySIDs = g_hash_table_size(pCheckpoint->pSIDs);
+
+        if (memorySIDs >= SPILL_MIN_SIDS && memorySIDs >= pCheckpoint->spillSIDs / 8 && CheckpointSpill(pCheckpoint))
+        {
+            spilled += memorySIDs - g_hash_table_size(pCheckpoint->pSIDs);
+        }
+    }
+
+    if (spilled > 0)
+    {
+        malloc_trim(0);
+
+        fprintf(stderr, "Spill      : %.1f MB resident over %d MB, %ld SIDs to disk, now %.1f MB\n",
+                rss / 1048576.0, g_cmdArgs.memoryMB, spilled, MetricsRSS() / 1048576.0);
+    }
+}
+
+// Lists the calls up to pEndDate for every account and fetches their events
+// over one fetch engine, resuming from and saving the checkpoints when
+// configured. False when any listing failed part-way.
+
+bool FetchCalls(Account *pAccounts, int accounts, bool bBatch, const char *pEndDate)
+{
+    FetchEngine engine;
+
+    if (!FetchEngineInit(&engine, g_cmdArgs.eventsInFlight, g_cmdArgs.eventsQueueDepth))
+    {
+        exit(EXIT_FAILURE);
+    }
+
+    StartParsing(pAccounts, accounts);
+
+    for (int account=0; account<accounts; account++)
+    {
+        StartListing(&pAccounts[account], bBatch, pEndDate);
+    }
+
+    int  next      = 0;
+    long processed = 0;
+
+    Account    *pAccount;
+    CallRecord *pRecord;
+
+    while ((pRecord = NextCall(pAccounts, accounts, &engine, &next, &pAccount)))
+    {
+        ProcessCall(pRecord, pAccount, &engine);
+
+        if (g_cmdArgs.memoryMB && ++processed % MEMORY_CHECK_CALLS == 0)
+        {
+            KeepMemoryBudget(pAccounts, accounts);
+        }
+    }
+
+    FetchEngineDrain(&engine);
+    FetchEngineCleanup(&engine);
+
+    FinishParsing(pAccounts, accounts);
+
+    bool bComplete = true;
+
+    for (int account=0; account<accounts; account++)
+    {
+        bComplete = FinishListing(&pAccounts[account]) && bComplete;
+    }
+
+    TransportShowStats();
+    ThrottleShowStats();
+
+    return bComplete;
+}
+
+// Rebuilds the aggregates from a dump without touching the network. Lines
+// written before the call metadata was recorded only count towards totals.
+
+bool ReplayDump(const char *pPath, KeyTable *pKeyMap)
+{
+    DumpReader *pReader = DumpReaderOpen(pPath);
+
+    if (!pReader)
+    {
+        return false;
+    }
+
+    time_t startDay = ParseDate(g_cmdArgs.pStartDate);
+    time_t endDay   = ParseDate(g_cmdArgs.pEndDate) + 24 * 60 * 60;
+
+    long replayed = 0, skipped = 0, malformed = 0;
+
+    const char *pLine;
+    size_t     lineLen;
+
+    while ((pLine = DumpReadLine(pReader, &lineLen)))
+    {
+        if (lineLen == 0)
+        {
+            continue;
+        }
+
+        json_error_t err;
+
+        double parseStart = MetricsNow();
+
+        json_t *pLineJSON = json_loadb(pLine, lineLen, 0, &err);
+
+        MetricsRecordStage(METRIC_STAGE_EVENTS_PARSE, MetricsNow() - parseStart);
+
+        if (!pLineJSON)
+        {
+            malformed++;
+            continue;
+        }
+
+        json_t *pResponseJSON = json_object_get(pLineJSON, "response");
+        json_t *pStartJSON    = json_object_get(pLineJSON, "start_time");
+
+        const char *pSID = json_string_value(json_object_get(pLineJSON, "sid"));
+        int        day   = json_integer_value(json_object_get(pLineJSON, "day"));
+
+        if (!pResponseJSON && json_object_get(pLineJSON, "events"))
+        {
+            pResponseJSON = pLineJSON;
+        }
+
+        if (!pResponseJSON || !json_object_get(pResponseJSON, "events"))
+        {
+            malformed++;
+        }
+        else if (pStartJSON && (json_integer_value(pStartJSON) < startDay || json_integer_value(pStartJSON) >= endDay))
+        {
+            skipped++;
+        }
+        else
+        {
+            double aggregateStart = MetricsNow();
+
+            LogEvents(pResponseJSON, pKeyMap, day, pSID ? pSID : "");
+
+            MetricsRecordStage(METRIC_STAGE_AGGREGATE, MetricsNow() - aggregateStart);
+
+            replayed++;
+        }
+
+        json_decref(pLineJSON);
+    }
+
+    fprintf(stderr, "Replay     : %ld calls, %ld outside the dates, %ld malformed\n", replayed, skipped, malformed);
+
+    // A partial replay would pass for the complete totals
+
+    bool bComplete = !pReader->bError;
+
+    if (!bComplete)
+    {
+        fprintf(stderr, "Failure replaying %s, the dump is corrupt or truncated\n", pPath);
+    }
+
+    DumpReaderClose(pReader);
+
+    return bComplete;
+}
+
+// Rebuilds every account's counts for the dates from the call store
+
+bool QueryStore(Account *pAccounts, int accounts)
+{
+    time_t fromTime = ParseDate(g_cmdArgs.pStartDate);
+    time_t toTime   = ParseDate(g_cmdArgs.pEndDate) + 24 * 60 * 60;
+
+    for (int account=0; account<accounts; account++)
+    {
+        if (!CallStoreQuery(g_cmdArgs.pStorePath, pAccounts[account].pAccount, fromTime, toTime, pAccounts[account].pKeyMap))
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+static char doc[]      = "CAN-TV Utility";
+static char args_doc[] = "";
+
+static struct argp_option options[] = 
+{
+    {"startdate",  's', "2021-03-01",   0, "Start date"},
+    {"enddate",    'e', "2021-03-31",   0, "End date"},
+    {"account",    'a', "blank",        0, "Account ID, required unless --accounts is given"},  
+    {"apikey",     'k', "blank",        0, "API Key, required to fetch unless --accounts is given"},   
+    {"emailfrom",  'f', "me@gmail.com", 0, "From gmail account"},
+    {"emailname",  'n', "My Name",      0, "Name i.e. John Smith"},
+    {"emailto",    't', "you@gmail.com",0, "To e-mail account, empty to skip sending"},  
+    {"emailpass",  'p', "mypassword",   0, "From gmail account password"},                 
+    {"concurrency",'c', "16",           0, "Events.json requests in flight"},
+    {"queuedepth", 'q', "64",           0, "Events.json requests queued"},
+    {"listdepth",  'l', "1000",         0, "Listed calls waiting for processing"},
+    {"cachedir",   'd', "cache",        0, "Cache Events.json responses in this directory"},
+    {"cachemb",    'm', "512",          0, "Events.json cache size limit in MB"},
+    {"cacheentries",'i',"262144",       0, "Events.json cache entry limit"},
+    {"checkpoint", 'r', "state.json",   0, "Resume from and save aggregation state in this file"},
+    {"dump",       'o', "dump.ndjson",  0, "Write raw Events.json responses here, empty to disable"},
+    {"dumpgzip",   'z', 0,              0, "Compress the dump with gzip"},
+    {"dumpmb",     'M', "0",            0, "Dump size limit in MB, 0 for none"},
+    {"shards",     'S', "1",            0, "Split the date range into this many listings walked in parallel"},
+    {"rate",       'R', "0",            0, "Requests per second cap, 0 for none"},
+    {"mailgzip",   'G', 0,              0, "Send the report attachment gzip compressed"},
+    {"baseurl",    'B', "https://api.twilio.com", 0, "Twilio API base URL"},
+    {"metrics",    'P', "cantv.prom",   0, "Write Prometheus metrics to this textfile at exit"},
+    {"summary",    'J', "metrics.json", 0, "Write a JSON metrics summary to this file at exit"},
+    {"replay",     'x', "dump.ndjson",  0, "Rebuild the report from a recorded dump without network access"},
+    {"accounts",   'A', "accounts.txt", 0, "Report on every ACCOUNT:APIKEY line of this file in one run"},
+    {"marker",     'K', " number | will appear", 0, "Left|right text around the digits in a response body, repeat for more phrasings"},
+    {"store",      'T', "calls",        0, "Keep every counted call in this directory for later queries"},
+    {"query",      'Q', 0,              0, "Rebuild the report for the dates from the call store without network access"},
+    {"workers",    'W', "4",            0, "Threads parsing Events.json responses, 0 to parse on the fetch thread"},
+    {"serve",      'D', "8080",         0, "Keep running, polling Twilio and serving the report on this local port"},
+    {"interval",   'I', "300",          0, "Seconds between polls in service mode"},
+    {"mailevery",  'E', "86400",        0, "Seconds between report emails in service mode, 0 for none"},
+    {"memory",     'X', "1024",         0, "Resident memory budget in MB, counted call SIDs are spilled to disk above it, 0 for none"},
+    { 0 }
+};
+
+static error_t parse_opt (int key, char *arg, struct argp_state *state)
+{
+    CmdLineArgs *arguments = state->input;
+    
+    switch (key)
+    {    
+        case 's':
+            arguments->pStartDate = arg;
+            break;
+        
+        case 'f':
+            arguments->pEmailFrom = arg;
+            break;  
+        
+        case 'n':
+            arguments->pEmailFromName = arg;
+            break;                            
+
+        case 't':
+            arguments->pEmailTo = arg;
+            break;  
+        
+        case 'p':
+            arguments->pEmailPassword = arg;
+            break;                                            
+
+        case 'e':
+            arguments->pEndDate = arg;
+            break;
+
+        case 'a':
+            arguments->pAccount = arg;
+            break;
+
+        case 'k':    
+            arguments->pAPIKey = arg;
+            break;           
+
+        case 'c':
+            arguments->eventsInFlight = atoi(arg);
+            break;
+
+        case 'q':
+            arguments->eventsQueueDepth = atoi(arg);
+            break;
+
+        case 'l':
+            arguments->listDepth = atoi(arg);
+            break;
+
+        case 'd':
+            arguments->pCacheDir = arg;
+            break;
+
+        case 'm':
+            arguments->cacheMB = atoi(arg);
+            break;
+
+        case 'i':
+            arguments->cacheEntries = atoi(arg);
+            break;
+
+        case 'r':
+            arguments->pCheckpointPath = arg;
+            break;
+
+        case 'o':
+            arguments->pDumpPath = arg;
+            break;
+
+        case 'z':
+            arguments->bDumpCompress = true;
+            break;
+
+        case 'M':
+            arguments->dumpMB = atoi(arg);
+            break;
+
+        case 'S':
+            arguments->listShards = atoi(arg);
+            break;
+
+        case 'R':
+            arguments->requestRate = atoi(arg);
+            break;
+
+        case 'G':
+            arguments->bMailCompress = true;
+            break;
+
+        case 'B':
+            arguments->pBaseURL = arg;
+            break;
+
+        case 'P':
+            arguments->pMetricsPath = arg;
+            break;
+
+        case 'J':
+            arguments->pSummaryPath = arg;
+            break;
+
+        case 'x':
+            arguments->pReplayPath = arg;
+            break;
+
+        case 'A':
+            arguments->pAccountsPath = arg;
+            break;
+
+        case 'T':
+            arguments->pStorePath = arg;
+            break;
+
+        case 'Q':
+            arguments->bQuery = true;
+            break;
+
+        case 'W':
+            arguments->parseWorkers = atoi(arg);
+            break;
+
+        case 'D':
+            arguments->servePort = atoi(arg);
+            break;
+
+        case 'I':
+            arguments->serveInterval = atoi(arg);
+            break;
+
+        case 'E':
+            arguments->mailEvery = atoi(arg);
+            break;
+
+        case 'X':
+            arguments->memoryMB = atoi(arg);
+            break;
+
+        case 'K':
+            if (arguments->markerCount >= MATCHER_MAX_PAIRS)
+            {
+                argp_error(state, "at most %d markers", MATCHER_MAX_PAIRS);
+            }
+
+            arguments->pMarkers[arguments->markerCount++] = arg;
+            break;
+
+        case ARGP_KEY_ARG:         
+            argp_usage(state);
+            break;
+        
+        case ARGP_KEY_END:   
+            if (!arguments->pAccountsPath && !arguments->pAccount)
+            {
+                argp_error(state, "--account is required unless --accounts is given");
+            }
+
+            if (!arguments->pAccountsPath && !arguments->pAPIKey && !arguments->pReplayPath && !arguments->bQuery)
+            {
+                argp_error(state, "--apikey is required unless --accounts, --replay or --query is given");
+            }
+            break;
+        
+        default:         
+            return ARGP_ERR_UNKNOWN;
+    }
+    
+    return 0;
+}
+
+static struct argp argp = { options, parse_opt, args_doc, doc };
+
+void ParseCommandLine(int argc, char **argv)
+{
+    g_cmdArgs.pAccount       = NULL;
+    g_cmdArgs.pAPIKey        = NULL;
+    g_cmdArgs.pStartDate     = "2021-03-01";
+    g_cmdArgs.pEndDate       = "2021-03-31";
+    g_cmdArgs.pEmailFrom     = "me@gmail.com";
+    g_cmdArgs.pEmailTo       = "you@gmail.com";
+    g_cmdArgs.pEmailFromName = "My Name";
+    g_cmdArgs.pEmailPassword = "mypassword"; 
+    g_cmdArgs.eventsInFlight   = 16;
+    g_cmdArgs.eventsQueueDepth = 64;
+    g_cmdArgs.listDepth        = 1000;
+    g_cmdArgs.listShards       = 1;
+    g_cmdArgs.requestRate      = 0;
+    g_cmdArgs.pCacheDir        = NULL;
+    g_cmdArgs.cacheMB          = 512;
+    g_cmdArgs.cacheEntries     = 262144;
+    g_cmdArgs.pCheckpointPath  = NULL;
+    g_cmdArgs.pDumpPath        = "dump.ndjson";
+    g_cmdArgs.bDumpCompress    = false;
+    g_cmdArgs.dumpMB           = 0;
+    g_cmdArgs.bMailCompress    = false;
+    g_cmdArgs.pBaseURL         = "https://api.twilio.com";
+    g_cmdArgs.pMetricsPath     = NULL;
+    g_cmdArgs.pSummaryPath     = NULL;
+    g_cmdArgs.pReplayPath      = NULL;
+    g_cmdArgs.markerCount      = 0;
+    g_cmdArgs.pAccountsPath    = NULL;
+    g_cmdArgs.pStorePath       = NULL;
+    g_cmdArgs.bQuery           = false;
+    g_cmdArgs.parseWorkers     = g_get_num_processors();
+    g_cmdArgs.servePort        = 0;
+    g_cmdArgs.serveInterval    = 300;
+    g_cmdArgs.mailEvery        = 86400;
+    g_cmdArgs.memoryMB         = 0;
+
+    argp_parse(&argp, argc, argv, 0, 0, &g_cmdArgs);    
+
+    if (g_cmdArgs.markerCount == 0)
+    {
+        g_cmdArgs.pMarkers[g_cmdArgs.markerCount++] = " number | will appear";
+    }
+}
+
+void ShowStartup()
+{
+   fprintf(stderr, "Start Date : %s\n", g_cmdArgs.pStartDate);
+   fprintf(stderr, "End Date   : %s\n", g_cmdArgs.pEndDate);
+   fprintf(stderr, "Account    : %s\n", g_cmdArgs.pAccountsPath ? g_cmdArgs.pAccountsPath : g_cmdArgs.pAccount);
+   fprintf(stderr, "API Key    : %s\n", g_cmdArgs.pAPIKey ? "(set)" : "(none)");
+   fprintf(stderr, "gmail From : %s\n", g_cmdArgs.pEmailFrom);
+   fprintf(stderr, "gmail Name : %s\n", g_cmdArgs.pEmailFromName);
+   fprintf(stderr, "gmail PW   : %s\n", g_cmdArgs.pEmailPassword);
+   fprintf(stderr, "EMail To   : %s\n", g_cmdArgs.pEmailTo);   
+   fprintf(stderr, "EMail Gzip : %s\n", g_cmdArgs.bMailCompress ? "yes" : "no");
+   fprintf(stderr, "In Flight  : %d\n", g_cmdArgs.eventsInFlight);
+   fprintf(stderr, "Queue Depth: %d\n", g_cmdArgs.eventsQueueDepth);
+   fprintf(stderr, "List Depth : %d\n", g_cmdArgs.listDepth);
+   fprintf(stderr, "Shards     : %d\n", g_cmdArgs.listShards);
+   fprintf(stderr, "Rate Cap   : %d\n", g_cmdArgs.requestRate);
+   fprintf(stderr, "Workers    : %d\n", g_cmdArgs.parseWorkers);
+   fprintf(stderr, "Memory Cap : %d MB\n", g_cmdArgs.memoryMB);
+   fprintf(stderr, "Cache Dir  : %s\n", g_cmdArgs.pCacheDir ? g_cmdArgs.pCacheDir : "(disabled)");
+   fprintf(stderr, "Checkpoint : %s\n", g_cmdArgs.pCheckpointPath ? g_cmdArgs.pCheckpointPath : "(disabled)");
+   fprintf(stderr, "Base URL   : %s\n", g_cmdArgs.pBaseURL);
+   fprintf(stderr, "Metrics    : %s\n", g_cmdArgs.pMetricsPath ? g_cmdArgs.pMetricsPath : "(disabled)");
+   fprintf(stderr, "Summary    : %s\n", g_cmdArgs.pSummaryPath ? g_cmdArgs.pSummaryPath : "(disabled)");
+   for (int marker=0; marker<g_cmdArgs.markerCount; marker++)
+   {
+       fprintf(stderr, "Marker     : \"%s\"\n", g_cmdArgs.pMarkers[marker]);
+   }
+
+   fprintf(stderr, "Replay     : %s\n", g_cmdArgs.pReplayPath ? g_cmdArgs.pReplayPath : "(disabled)");
+   fprintf(stderr, "Call Store : %s%s\n", g_cmdArgs.pStorePath ? g_cmdArgs.pStorePath : "(disabled)", g_cmdArgs.bQuery ? " (query)" : "");
+   fprintf(stderr, "Dump       : %s%s\n", *g_cmdArgs.pDumpPath ? g_cmdArgs.pDumpPath : "(disabled)", g_cmdArgs.bDumpCompress ? " (gzip)" : "");
+
+   if (g_cmdArgs.servePort)
+   {
+       fprintf(stderr, "Serve Port : %d\n", g_cmdArgs.servePort);
+       fprintf(stderr, "Interval   : %d s\n", g_cmdArgs.serveInterval);
+       fprintf(stderr, "Mail Every : %d s\n", g_cmdArgs.mailEvery);
+   }
+}
+
+typedef struct 
+{
+    ReportBuffer *pReport;
+    int          totals[32];
+} ShowContentsData;
+
+void ShowContents(int key, const int *pValues, void *pUserData)
+{
+    ShowContentsData *pData =  (ShowContentsData *) pUserData;
+
+    if (key == KEY_TABLE_INVALID)
+    {
+        ReportBufferAppendText(pData->pReport, "Invalid");
+    }
+    else
+    {
+        ReportBufferAppendInt(pData->pReport, key);
+    }
+
+    for (int index=0; index<32; index++)
+    {
+        ReportBufferAppend(pData->pReport, ",", 1);
+        ReportBufferAppendInt(pData->pReport, pValues[index]);
+
+        pData->totals[index] += pValues[index];                    
+    }
+
+    ReportBufferAppend(pData->pReport, "\n", 1);
+}
+
+#define REPORT_HEADER "Keys,Total,1,2,3,4,5,6,7,8,9,10,11,12,13,14,15,16,17,18,19,20,21,22,23,24,25,26,27,28,29,30,31\n"
+
+void RenderReport(ReportBuffer *pReport, KeyTable *pKeyMap)
+{
+    ShowContentsData data;
+
+    for (int index=0; index<32; index++)
+    {
+        data.totals[index] = 0;
+    }    
+
+    data.pReport = pReport;
+
+    ReportBufferAppendText(data.pReport, REPORT_HEADER);
+
+    KeyTableForEachSorted(pKeyMap, ShowContents, &data);
+
+    ReportBufferAppendText(data.pReport, "Total");
+
+    for (int index=0; index<32; index++)
+    {
+        ReportBufferAppend(data.pReport, ",", 1);
+        ReportBufferAppendInt(data.pReport, data.totals[index]);
+    }
+}
+
+// The report as JSON for the service endpoint, one row per key in the CSV
+// order ending with the Total row
+
+typedef struct
+{
+    json_t *pRows;
+    int    totals[32];
+} ReportRowsData;
+
+static json_t *ReportRow(json_t *pKey, const int *pValues)
+{
+    json_t *pRow  = json_object();
+    json_t *pDays = json_array();
+
+    for (int index=1; index<32; index++)
+    {
+        json_array_append_new(pDays, json_integer(pValues[index]));
+    }
+
+    json_object_set_new(pRow, "key",   pKey);
+    json_object_set_new(pRow, "total", json_integer(pValues[0]));
+    json_object_set_new(pRow, "days",  pDays);
+
+    return pRow;
+}
+
+static void AddReportRow(int key, const int *pValues, void *pUserData)
+{
+    ReportRowsData *pData = (ReportRowsData *) pUserData;
+
+    json_array_append_new(pData->pRows, ReportRow(key == KEY_TABLE_INVALID ? json_string("Invalid") : json_integer(key), pValues));
+
+    for (int index=0; index<32; index++)
+    {
+        pData->totals[index] += pValues[index];
+    }
+}
+
+char *RenderReportJSON(KeyTable *pKeyMap)
+{
+    ReportRowsData data = { json_array() };
+
+    KeyTableForEachSorted(pKeyMap, AddReportRow, &data);
+
+    json_array_append_new(data.pRows, ReportRow(json_string("Total"), data.totals));
+
+    char updated[100];
+
+    GetGMTTime(updated, sizeof(updated));
+
+    json_t *pReport = json_object();
+
+    json_object_set_new(pReport, "start_date", json_string(g_cmdArgs.pStartDate));
+    json_object_set_new(pReport, "updated",    json_string(updated));
+    json_object_set_new(pReport, "rows",       data.pRows);
+
+    char *pJSON = json_dumps(pReport, JSON_COMPACT);
+
+    json_decref(pReport);
+
+    return pJSON;
+}
+
+// Hands the service endpoint CSV and JSON snapshots of a report, the JSON
+// one named after the report with .json in place of .csv
+
+void PublishReport(const Report *pReport, KeyTable *pKeyMap)
+{
+    char *pCSV = ReportBufferCopy(&pReport->csv);
 
-                                        bool bFound = false;
+    if (pCSV)
+    {
+        ServicePublish(pReport->pPath, pCSV, pReport->csv.length);
+    }
 
-                                        for (int index=0; index<arraySize; index++)
-                                        {
-                                            json_t *pEventJSON = json_array_get(pEventsJSON, index);
+    char *pJSON = RenderReportJSON(pKeyMap);
+
+    if (pJSON)
+    {
+        char *pJSONPath;
 
-                                            if (pEventJSON)
-                                            {
-                                                json_t *pResponseJSON = json_object_get(pEventJSON, "response");
+        asprintf(&pJSONPath, "%.*s.json", (int) strlen(pReport->pPath) - 4, pReport->pPath);
 
-                                                if (pResponseJSON)
-                                                {
-                                                    char *pResponseBody;
+        ServicePublish(pJSONPath, pJSON, strlen(pJSON));
 
-                                                    if (GetJSONString(pResponseJSON, &pResponseBody, "response_body"))
-                                                    {
-                                                        char *pDigits = NULL;
+        free(pJSONPath);
+    }
+}
 
-                                                        if (ExtractString(pResponseBody, " number ", " will appear", &pDigits))
-                                                        {
-                                                            fprintf(stderr, "%s,%s,%s\n", &pStart[5], pDigits, pSID);
+// Renders the report once then writes it, and publishes it in service mode
 
-                                                            LogDigits(pKeyMap, pDigits, day);
+bool BuildReport(Report *pReport, KeyTable *pKeyMap)
+{
+    ReportBufferReset(&pReport->csv);
 
-                                                            free(pDigits);
-                                                            free(pResponseBody);
-                                                            bFound = true;
+    RenderReport(&pReport->csv, pKeyMap);
 
-                                                            break;
-                                                        }
+    pReport->bBuilt = !pReport->csv.bFailed;
 
-                                                        free(pResponseBody);
-                                                    }
-                                                }
-                                            }
-                                        }
+    if (!pReport->bBuilt)
+    {
+        return false;
+    }
 
-                                        if (!bFound)
-                                        {   
-                                            LogDigits(pKeyMap, "1000000000", day);
-                                        }
-                                    }
+    if (g_cmdArgs.servePort)
+    {
+        PublishReport(pReport, pKeyMap);
+    }
 
-                                    json_decref(pResponseJSON);
-                                }  
-                                    
-                                FreeString(&pEventsResponse);
-                            }                    
+    return ReportBufferWriteFile(&pReport->csv, pReport->pPath);
+}
 
-                            //Log("%s,%s,%s,%s,%s,%s", pFrom, pTo, pStart, pEnd, pDuration, digits);
-                        }
+// The accounts of a batch run, one ACCOUNT:APIKEY per line with blank lines
+// and # comments skipped. Without a list the single account from the command
+// line is used.
 
-                        FreeString(&pSID);
-                        FreeString(&pFrom);
-                        FreeString(&pTo);        
-                        FreeString(&pStart);
-                        FreeString(&pEnd);
-                        FreeString(&pDuration);                                                      
-                    }
-                }
-            }
+int LoadAccounts(const char *pPath, Account **ppAccounts)
+{
+    if (!pPath)
+    {
+        Account *pAccount = calloc(1, sizeof(Account));
+
+        pAccount->pAccount = strdup(g_cmdArgs.pAccount);
+        pAccount->pAPIKey  = strdup(g_cmdArgs.pAPIKey ? g_cmdArgs.pAPIKey : "");
+        pAccount->pKeyMap  = KeyTableNew();
+
+        *ppAccounts = pAccount;
+
+        return 1;
+    }
+
+    FILE *pFile = fopen(pPath, "r");
+
+    if (!pFile)
+    {
+        fprintf(stderr, "Failure opening account list %s\n", pPath);
+        return 0;
+    }
+
+    Account *pAccounts = NULL;
+    int     accounts   = 0;
+
+    char    *pLine = NULL;
+    size_t  lineCapacity = 0;
+
+    while (getline(&pLine, &lineCapacity, pFile) > 0)
+    {
+        g_strstrip(pLine);
+
+        if (!*pLine || *pLine == '#')
+        {
+            continue;
         }
+
+        char *pSeparator = strchr(pLine, ':');
+
+        if (!pSeparator)
+        {
+            fprintf(stderr, "Skipping account line %s, expected ACCOUNT:APIKEY\n", pLine);
+            continue;
+        }
+
+        *pSeparator = 0;
+
+        pAccounts = realloc(pAccounts, (accounts + 1) * sizeof(Account));
+
+        memset(&pAccounts[accounts], 0, sizeof(Account));
+
+        pAccounts[accounts].pAccount = strdup(g_strstrip(pLine));
+        pAccounts[accounts].pAPIKey  = strdup(g_strstrip(pSeparator + 1));
+        pAccounts[accounts].pKeyMap  = KeyTableNew();
+
+        accounts++;
     }
 
-    FreeString(&pResponse);
-}
+    free(pLine);
 
-static char doc[]      = "CAN-TV Utility";
-static char args_doc[] = "";
+    fclose(pFile);
 
-static struct argp_option options[] = 
+    fprintf(stderr, "Accounts   : %d from %s\n", accounts, pPath);
+
+    *ppAccounts = pAccounts;
+
+    return accounts;
+}
+
+void FreeAccounts(Account *pAccounts, int accounts)
 {
-    {"startdate",  's', "2021-03-01",   0, "Start date"},
-    {"enddate",    'e', "2021-03-31",   0, "End date"},
-    {"account",    'a', "blank",        0, "Account ID"},  
-    {"apikey",     'k', "blank",        0, "API Key"},   
-    {"emailfrom",  'f', "me@gmail.com", 0, "From gmail account"},
-    {"emailname",  'n', "My Name",      0, "Name i.e. John Smith"},
-    {"emailto",    't', "you@gmail.com",0, "To e-mail account"},  
-    {"emailpass",  'p', "mypassword",   0, "From gmail account password"},                 
-    { 0 }
-};
+    for (int account=0; account<accounts; account++)
+    {
+        free(pAccounts[account].pAccount);
+        free(pAccounts[account].pAPIKey);
 
-static error_t parse_opt (int key, char *arg, struct argp_state *state)
+        KeyTableFree(pAccounts[account].pKeyMap);
+        CheckpointFree(pAccounts[account].pCheckpoint);
+        CallStoreClose(pAccounts[account].pStore);
+    }
+
+    free(pAccounts);
+}
+
+// Builds report.csv and in batch mode a report per account, leaving the ones
+// written in pReports with report.csv first. In service mode each report is
+// published to the endpoint as well.
+
+bool WriteReports(Account *pAccounts, int accounts, bool bBatch, GPtrArray *pReports)
 {
-    CmdLineArgs *arguments = state->input;
-    
-    switch (key)
-    {    
-        case 's':
-            arguments->pStartDate = arg;
-            break;
-        
-        case 'f':
-            arguments->pEmailFrom = arg;
-            break;  
-        
-        case 'n':
-            arguments->pEmailFromName = arg;
-            break;                            
+    g_ptr_array_remove_range(pReports, 1, pReports->len - 1);
 
-        case 't':
-            arguments->pEmailTo = arg;
-            break;  
-        
-        case 'p':
-            arguments->pEmailPassword = arg;
-            break;                                            
+    KeyTable *pCombined = pAccounts[0].pKeyMap;
 
-        case 'e':
-            arguments->pEndDate = arg;
-            break;
+    if (bBatch)
+    {
+        pCombined = KeyTableNew();
 
-        case 'a':
-            arguments->pAccount = arg;
-            break;
+        for (int account=0; account<accounts; account++)
+        {
+            char *pReportPath;
 
-        case 'k':    
-            arguments->pAPIKey = arg;
-            break;           
+            asprintf(&pReportPath, "report-%s.csv", pAccounts[account].pAccount);
 
-        case ARGP_KEY_ARG:         
-            argp_usage(state);
-            break;
-        
-        case ARGP_KEY_END:   
-            break;
-        
-        default:         
-            return ARGP_ERR_UNKNOWN;
+            KeyTableMerge(pCombined, pAccounts[account].pKeyMap);
+
+            Report *pReport = ReportNew(pReportPath);
+
+            if (BuildReport(pReport, pAccounts[account].pKeyMap))
+            {
+                g_ptr_array_add(pReports, pReport);
+            }
+            else
+            {
+                ReportFree(pReport);
+            }
+
+            free(pReportPath);
+        }
     }
-    
-    return 0;
-}
 
-static struct argp argp = { options, parse_opt, args_doc, doc };
+    bool bWritten = BuildReport(g_ptr_array_index(pReports, 0), pCombined);
 
-void ParseCommandLine(int argc, char **argv)
+    if (bBatch)
+    {
+        KeyTableFree(pCombined);
+    }
+
+    return bWritten;
+}
+
+void WriteMetrics()
 {
-    g_cmdArgs.pAccount       = "AC5b4731b15db3d93a9f93b72ebeece5ea";
-    g_cmdArgs.pAPIKey        = "38b6e0a6c0332e4d54a6680bc944f78c";
-    g_cmdArgs.pStartDate     = "2021-03-01";
-    g_cmdArgs.pEndDate       = "2021-03-31";
-    g_cmdArgs.pEmailFrom     = "me@gmail.com";
-    g_cmdArgs.pEmailTo       = "you@gmail.com";
-    g_cmdArgs.pEmailFromName = "My Name";
-    g_cmdArgs.pEmailPassword = "mypassword"; 
+    if (g_cmdArgs.pMetricsPath)
+    {
+        MetricsWritePrometheus(g_cmdArgs.pMetricsPath);
+    }
 
-    argp_parse(&argp, argc, argv, 0, 0, &g_cmdArgs);    
+    if (g_cmdArgs.pSummaryPath)
+    {
+        MetricsWriteJSON(g_cmdArgs.pSummaryPath);
+    }
 }
 
-void ShowStartup()
+static void StopService(int signalNumber)
 {
-   fprintf(stderr, "Start Date : %s\n", g_cmdArgs.pStartDate);
-   fprintf(stderr, "End Date   : %s\n", g_cmdArgs.pEndDate);
-   fprintf(stderr, "Account    : %s\n", g_cmdArgs.pAccount);
-   fprintf(stderr, "API Key    : %s\n", g_cmdArgs.pAPIKey);
-   fprintf(stderr, "gmail From : %s\n", g_cmdArgs.pEmailFrom);
-   fprintf(stderr, "gmail Name : %s\n", g_cmdArgs.pEmailFromName);
-   fprintf(stderr, "gmail PW   : %s\n", g_cmdArgs.pEmailPassword);
-   fprintf(stderr, "EMail To   : %s\n", g_cmdArgs.pEmailTo);   
+    g_bDone = true;
 }
 
-typedef struct 
+// First day of the month after the one pDate falls in
+
+static void NextMonth(const char *pDate, char *pNext, int nextLength)
 {
-    GHashTable *pKeyValues;
-    FILE       *pReportFile;
-    int        totals[32];
-} ShowContentsData;
+    int year  = 0;
+    int month = 1;
 
-void ShowContents(gpointer pKey, gpointer pUserData)
+    sscanf(pDate, "%d-%d", &year, &month);
+
+    snprintf(pNext, nextLength, "%04d-%02d-01", month == 12 ? year + 1 : year, month % 12 + 1);
+}
+
+// Empty tables and checkpoints for the next month. A checkpoint file is for
+// the old window, so loading it later starts fresh.
+
+static void ResetAccounts(Account *pAccounts, int accounts)
 {
-    ShowContentsData *pData =  (ShowContentsData *) pUserData;
+    for (int account=0; account<accounts; account++)
+    {
+        KeyTableFree(pAccounts[account].pKeyMap);
+        CheckpointFree(pAccounts[account].pCheckpoint);
+
+        pAccounts[account].pKeyMap     = KeyTableNew();
+        pAccounts[account].pCheckpoint = NULL;
+    }
+}
+
+// Service mode polls for new calls up to today every interval, with the
+// aggregates and checkpoints kept resident, and republishes the reports after
+// each poll. Emails go out on their own timer. Runs until SIGINT or SIGTERM.
+//
+// Counts are kept by day of month, so the window never spans two months. A
+// poll ends at the last day of the window's month at the latest. Once today
+// is past that month, the closed month's report is published and mailed, then
+// counting restarts from the first of the next month.
+
+static char s_windowStart[32];
+
+void RunService(Account *pAccounts, int accounts, bool bBatch, GPtrArray *pReports)
+{
+    if (!ServiceStart(g_cmdArgs.servePort))
+    {
+        exit(EXIT_FAILURE);
+    }
 
-    int *pValues = (int *) g_hash_table_lookup(pData->pKeyValues, pKey);
+    signal(SIGINT,  StopService);
+    signal(SIGTERM, StopService);
 
-    if (pValues)
+    snprintf(s_windowStart, sizeof(s_windowStart), "%s", g_cmdArgs.pStartDate);
+
+    g_cmdArgs.pStartDate = s_windowStart;
+
+    time_t nextMail = time(NULL) + g_cmdArgs.mailEvery;
+
+    while (!g_bDone)
     {
-        if (strcmp(pKey, "1000000000") == 0)
+        char today[32], nextMonth[32], pollEnd[32];
+
+        time_t    now     = time(NULL);
+        struct tm nowTime = *gmtime(&now);
+
+        strftime(today, sizeof(today), "%Y-%m-%d", &nowTime);
+
+        NextMonth(s_windowStart, nextMonth, sizeof(nextMonth));
+
+        bool bMonthClosed = strcmp(today, nextMonth) >= 0;
+
+        if (bMonthClosed)
         {
-            fprintf(pData->pReportFile, "Invalid");
+            time_t    monthEnd     = ParseDate(nextMonth) - 24 * 60 * 60;
+            struct tm monthEndTime = *gmtime(&monthEnd);
+
+            strftime(pollEnd, sizeof(pollEnd), "%Y-%m-%d", &monthEndTime);
         }
         else
         {
-            fprintf(pData->pReportFile, "%s", (const char *) pKey);
+            snprintf(pollEnd, sizeof(pollEnd), "%s", today);
+        }
+
+        double pollStart = MetricsNow();
+
+        bool bComplete = FetchCalls(pAccounts, accounts, bBatch, pollEnd);
+
+        WriteMetrics();
+
+        bool bWritten = WriteReports(pAccounts, accounts, bBatch, pReports);
+
+        fprintf(stderr, "Poll       : %s to %s in %.2f s%s\n", s_windowStart, pollEnd, MetricsNow() - pollStart, bComplete ? "" : ", listing incomplete");
+
+        // A month is only mailed and closed once a poll has listed all of it
+
+        bMonthClosed = bMonthClosed && bComplete;
+
+        // Months closed while catching up from an old --startdate aren't mailed
+
+        bool bJustClosed = bMonthClosed && strncmp(today, nextMonth, 7) == 0;
+        bool bMailDue    = g_cmdArgs.mailEvery > 0 && (bJustClosed || time(NULL) >= nextMail);
+
+        if (bComplete && bWritten && bMailDue && *g_cmdArgs.pEmailTo)
+        {
+            MailReports(pReports);
+
+            while (nextMail <= time(NULL))
+            {
+                nextMail += g_cmdArgs.mailEvery;
+            }
         }
 
-        for (int index=0; index<32; index++)
+        if (bMonthClosed)
         {
-            fprintf(pData->pReportFile, ",%d", pValues[index]);
+            fprintf(stderr, "Month      : %.7s closed, counting from %s\n", s_windowStart, nextMonth);
 
-            pData->totals[index] += pValues[index];                    
+            snprintf(s_windowStart, sizeof(s_windowStart), "%s", nextMonth);
+
+            ResetAccounts(pAccounts, accounts);
+
+            // Catch up on the next month straight away
+
+            continue;
         }
 
-        fprintf(pData->pReportFile,"\n");
+        for (int second=0; second<g_cmdArgs.serveInterval && !g_bDone; second++)
+        {
+            g_usleep(1000 * 1000);
+        }
     }
+
+    ServiceStop();
 }
 
 void Test()
 {
-    char *pTestURL;
+    char *pTestURL, *pUserPass;
 
     const char *pSID = "CA53c7354b6d2f15a2338d6165f4c83a9b";
     
-    asprintf(&pTestURL, "https://api.twilio.com/2010-04-01/Accounts/AC5b4731b15db3d93a9f93b72ebeece5ea/Calls/%s/Events.json", pSID);
+
+    asprintf(&pTestURL,  "%s/2010-04-01/Accounts/%s/Calls/%s/Events.json", g_cmdArgs.pBaseURL, g_cmdArgs.pAccount, pSID);
+    asprintf(&pUserPass, "%s:%s", g_cmdArgs.pAccount, g_cmdArgs.pAPIKey);
 
     char *pTestResponse = NULL;
 
-    int response = GetHTTP(pTestURL, "AC5b4731b15db3d93a9f93b72ebeece5ea:38b6e0a6c0332e4d54a6680bc944f78c", &pTestResponse);
+    int response = GetHTTP(pTestURL, pUserPass, &pTestResponse);
 
     free(pTestURL);
+    free(pUserPass);
 
     if (response == 200)
     {
@@ -755,142 +2574,114 @@ void Test()
     FreeString(&pTestResponse);    
 }
 
-int SortCallback(gconstpointer pA, gconstpointer pB)
-{  
-    const char *pCharA = *((char **) pA);
-    const char *pCharB = *((char **) pB);
-
-    int a = atoi(pCharA);
-    int b = atoi(pCharB);
-
-    if (a < b) return -1;
-    if (a > b) return  1;
-
-    return 0;
-}
-
-void AddKeyToArray(gpointer pKey, gpointer pValue, gpointer pUserData)
-{
-    GPtrArray *pKeyArray = (GPtrArray *) pUserData;
-
-    g_ptr_array_insert(pKeyArray, -1, pKey);
-}
-
-#define REPORT_HEADER "Keys,Total,1,2,3,4,5,6,7,8,9,10,11,12,13,14,15,16,17,18,19,20,21,22,23,24,25,26,27,28,29,30,31\n"
-
 void main(int argc, char **pArgv)
 {
     ParseCommandLine(argc, pArgv);
 
     ShowStartup();
 
-#ifdef COMMENT_OUT
-
-    char *pStartYMDHMS, *pEndYMDHMS, *pURL, *pUserPass;
-
-    asprintf(&pStartYMDHMS, "%sT00:00:00-00:00", g_cmdArgs.pStartDate);
-    asprintf(&pEndYMDHMS,   "%sT23:59:59-00:00", g_cmdArgs.pEndDate);
-    asprintf(&pUserPass,    "%s:%s",             g_cmdArgs.pAccount, g_cmdArgs.pAPIKey);
-
-    asprintf(&pURL, "/2010-04-01/Accounts/%s/Calls.json?StartTime>=%s&EndTime<=%s", g_cmdArgs.pAccount, pStartYMDHMS, pEndYMDHMS);
+    curl_global_init(CURL_GLOBAL_DEFAULT);
 
-    free(pStartYMDHMS);
-    free(pEndYMDHMS);
+    TransportInit();
 
-    GHashTable *pKeyMap = g_hash_table_new_full(g_str_hash, g_str_equal, free, free);
+    ThrottleInit(g_cmdArgs.requestRate, g_cmdArgs.eventsInFlight);
 
-    json_t *pDump = json_object();
+    MetricsInit();
 
-    g_pResponseArray = json_array();    
+    g_pMatcher = MatcherNew();
 
-    json_object_set_new(pDump, "responses", g_pResponseArray);    
-
-    char *pNextURL = NULL;    
-    
-    while (1)
+    for (int marker=0; marker<g_cmdArgs.markerCount; marker++)
     {
-        pNextURL = NULL;
-
-        GetReport(pURL, pUserPass, &pNextURL, pKeyMap);
-        
-        if (!pNextURL)
+        if (!MatcherAddSpec(g_pMatcher, g_cmdArgs.pMarkers[marker]))
         {
-            break;
+            exit(EXIT_FAILURE);
         }
-        
-        free(pURL);
-        pURL = pNextURL;        
     }
 
-    free(pURL);
-    free(pUserPass);
-
-    json_dump_file(pDump, "dump.json", 0);
-
-    json_decref(pDump);
-
-    ShowContentsData data;
-
-    for (int index=0; index<32; index++)
+    if (!MatcherCompile(g_pMatcher))
     {
-        data.totals[index] = 0;
-    }    
+        exit(EXIT_FAILURE);
+    }
 
-    data.pReportFile = fopen("report.csv", "wb");    
+    // report.csv first, then one report per account in batch mode
 
-    if (data.pReportFile)
-    {
-        GPtrArray *pKeyArray = g_ptr_array_new();
+    GPtrArray *pReports = g_ptr_array_new_with_free_func((GDestroyNotify) ReportFree);
+
+    g_ptr_array_add(pReports, ReportNew("report.csv"));
 
-        g_hash_table_foreach(pKeyMap, AddKeyToArray, pKeyArray);
+    bool bBatch = g_cmdArgs.pAccountsPath != NULL;
 
-        g_ptr_array_sort(pKeyArray, SortCallback); 
+    Account *pAccounts = NULL;
 
-        data.pKeyValues = pKeyMap;
+    int accounts = LoadAccounts(g_cmdArgs.pAccountsPath, &pAccounts);
 
-        fprintf(data.pReportFile, REPORT_HEADER);
+    if (accounts < 1 || ((bBatch || g_cmdArgs.servePort) && g_cmdArgs.pReplayPath))
+    {
+        fprintf(stderr, accounts < 1 ? "No accounts to report on\n" : "Replay takes a single account and doesn't serve\n");
+        exit(EXIT_FAILURE);
+    }
 
-        g_ptr_array_foreach(pKeyArray, ShowContents, &data);  
+    if (g_cmdArgs.bQuery && (!g_cmdArgs.pStorePath || g_cmdArgs.pReplayPath || g_cmdArgs.servePort))
+    {
+        fprintf(stderr, "Query needs --store and doesn't replay or serve\n");
+        exit(EXIT_FAILURE);
+    }
 
-        fprintf(data.pReportFile, "Total");
+    if (g_cmdArgs.bQuery)
+    {
+        if (!QueryStore(pAccounts, accounts))
+        {
+            exit(EXIT_FAILURE);
+        }
+    }
+    else if (g_cmdArgs.pReplayPath)
+    {
+        if (!ReplayDump(g_cmdArgs.pReplayPath, pAccounts[0].pKeyMap))
+        {
+            exit(EXIT_FAILURE);
+        }
+    }
+    else
+    {
+        OpenStores();
 
-        for (int index=0; index<32; index++)
+        if (g_cmdArgs.servePort)
         {
-            fprintf(data.pReportFile, ",%d", data.totals[index]);
+            RunService(pAccounts, accounts, bBatch, pReports);
         }
+        else if (!FetchCalls(pAccounts, accounts, bBatch, g_cmdArgs.pEndDate))
+        {
+            fprintf(stderr, "Failure listing the calls, no report written\n");
 
-        g_ptr_array_free(pKeyArray, false);
+            CloseStores();
 
-        fclose(data.pReportFile);    
-#endif
-        struct stat fileStat;
+            exit(EXIT_FAILURE);
+        }
 
-        if (stat("report.csv", &fileStat) == 0)
-        {
-            FILE *pCSVFile = fopen("report.csv", "rb");
+        CloseStores();
+    }
 
-            if (pCSVFile)
-            {   
-                unsigned char *pFileData = calloc(fileStat.st_size + 1, 1);
+    WriteMetrics();
 
-                fread(pFileData, 1, fileStat.st_size, pCSVFile);
+    if (WriteReports(pAccounts, accounts, bBatch, pReports))
+    {
+        // Service mode has already mailed on its timer
 
-                fclose(pCSVFile);
+        if (*g_cmdArgs.pEmailTo && !g_cmdArgs.servePort)
+        {
+            MailReports(pReports);
+        }
+    }
 
-                size_t encodedSize;
+    FreeAccounts(pAccounts, accounts);
 
-                char *pEncodedData = base64_encode(pFileData, fileStat.st_size, &encodedSize);
+    g_ptr_array_free(pReports, TRUE);
 
-                SendEmail("report.csv", pEncodedData);
+    MatcherFree(g_pMatcher);
 
-                free(pEncodedData);
+    fprintf(stderr, "Peak RSS   : %.1f MB\n", MetricsPeakRSS() / 1048576.0);
 
-                free(pFileData);
-            }    
-        }
-#ifdef COMMENT_OUT        
-    }
+    TransportCleanup();
 
-    g_hash_table_destroy(pKeyMap);    
-#endif    
+    curl_global_cleanup();
 }
\ No newline at end of file
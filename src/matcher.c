@@ -0,0 +1,229 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "matcher.h"
+
+Matcher *MatcherNew(void)
+{
+    return calloc(1, sizeof(Matcher));
+}
+
+bool MatcherAddPair(Matcher *pMatcher, const char *pLeft, const char *pRight)
+{
+    if (pMatcher->pairs >= MATCHER_MAX_PAIRS)
+    {
+        fprintf(stderr, "Too many markers, the limit is %d\n", MATCHER_MAX_PAIRS);
+        return false;
+    }
+
+    if (!*pLeft || !*pRight)
+    {
+        fprintf(stderr, "Markers can't be empty\n");
+        return false;
+    }
+
+    int pattern = 2 * pMatcher->pairs;
+
+    pMatcher->pPatterns[pattern]       = strdup(pLeft);
+    pMatcher->pPatterns[pattern + 1]   = strdup(pRight);
+    pMatcher->patternLens[pattern]     = strlen(pLeft);
+    pMatcher->patternLens[pattern + 1] = strlen(pRight);
+
+    pMatcher->pairs++;
+
+    return true;
+}
+
+bool MatcherAddSpec(Matcher *pMatcher, const char *pSpec)
+{
+    const char *pSeparator = strchr(pSpec, '|');
+
+    if (!pSeparator)
+    {
+        fprintf(stderr, "Marker %s should be left|right\n", pSpec);
+        return false;
+    }
+
+    char *pLeft = strndup(pSpec, pSeparator - pSpec);
+
+    bool bAdded = MatcherAddPair(pMatcher, pLeft, pSeparator + 1);
+
+    free(pLeft);
+
+    return bAdded;
+}
+
+// Builds the trie then turns it into a full transition table by following
+// failure links breadth first, so scanning is one table lookup per byte
+
+bool MatcherCompile(Matcher *pMatcher)
+{
+    int patterns  = 2 * pMatcher->pairs;
+    int maxStates = 1;
+
+    for (int pattern=0; pattern<patterns; pattern++)
+    {
+        maxStates += pMatcher->patternLens[pattern];
+    }
+
+    int32_t  *pDelta   = malloc((size_t) maxStates * 256 * sizeof(int32_t));
+    uint64_t *pOutputs = calloc(maxStates, sizeof(uint64_t));
+    int32_t  *pFail    = calloc(maxStates, sizeof(int32_t));
+    int32_t  *pQueue   = malloc(maxStates * sizeof(int32_t));
+
+    if (!pDelta || !pOutputs || !pFail || !pQueue)
+    {
+        fprintf(stderr, "Failure allocating a matcher of %d states\n", maxStates);
+
+        free(pDelta);
+        free(pOutputs);
+        free(pFail);
+        free(pQueue);
+        return false;
+    }
+
+    memset(pDelta, 0xff, (size_t) maxStates * 256 * sizeof(int32_t));
+
+    int states = 1;
+
+    for (int pattern=0; pattern<patterns; pattern++)
+    {
+        const unsigned char *pBytes = (const unsigned char *) pMatcher->pPatterns[pattern];
+
+        int32_t state = 0;
+
+        for (size_t index=0; index<pMatcher->patternLens[pattern]; index++)
+        {
+            int32_t *pNext = &pDelta[state * 256 + pBytes[index]];
+
+            if (*pNext < 0)
+            {
+                *pNext = states++;
+            }
+
+            state = *pNext;
+        }
+
+        pOutputs[state] |= (uint64_t) 1 << pattern;
+    }
+
+    int head = 0, tail = 0;
+
+    for (int byte=0; byte<256; byte++)
+    {
+        if (pDelta[byte] < 0)
+        {
+            pDelta[byte] = 0;
+        }
+        else
+        {
+            pFail[pDelta[byte]] = 0;
+            pQueue[tail++]      = pDelta[byte];
+        }
+    }
+
+    while (head < tail)
+    {
+        int32_t state = pQueue[head++];
+
+        for (int byte=0; byte<256; byte++)
+        {
+            int32_t next     = pDelta[state * 256 + byte];
+            int32_t fallback = pDelta[pFail[state] * 256 + byte];
+
+            if (next < 0)
+            {
+                pDelta[state * 256 + byte] = fallback;
+            }
+            else
+            {
+                pFail[next]     = fallback;
+                pOutputs[next] |= pOutputs[fallback];
+                pQueue[tail++]  = next;
+            }
+        }
+    }
+
+    free(pFail);
+    free(pQueue);
+
+    free(pMatcher->pDelta);
+    free(pMatcher->pOutputs);
+
+    // Only the states actually used are kept
+
+    int32_t *pShrunk = realloc(pDelta, (size_t) states * 256 * sizeof(int32_t));
+
+    pMatcher->pDelta   = pShrunk ? pShrunk : pDelta;
+    pMatcher->pOutputs = pOutputs;
+    pMatcher->states   = states;
+
+    return true;
+}
+
+int MatcherFind(const Matcher *pMatcher, const char *pText, size_t textLen, MatchView *pView)
+{
+    // End of the first left marker seen for each pair, SIZE_MAX until then
+
+    size_t leftEnds[MATCHER_MAX_PAIRS];
+
+    for (int pair=0; pair<pMatcher->pairs; pair++)
+    {
+        leftEnds[pair] = SIZE_MAX;
+    }
+
+    const int32_t  *pDelta   = pMatcher->pDelta;
+    const uint64_t *pOutputs = pMatcher->pOutputs;
+
+    int32_t state = 0;
+
+    for (size_t index=0; index<textLen; index++)
+    {
+        state = pDelta[state * 256 + (unsigned char) pText[index]];
+
+        uint64_t outputs = pOutputs[state];
+
+        while (outputs)
+        {
+            int pattern = __builtin_ctzll(outputs);
+            int pair    = pattern / 2;
+
+            size_t end = index + 1;
+
+            outputs &= outputs - 1;
+
+            if (!(pattern & 1))
+            {
+                if (leftEnds[pair] == SIZE_MAX)
+                {
+                    leftEnds[pair] = end;
+                }
+            }
+            else if (leftEnds[pair] != SIZE_MAX && end - pMatcher->patternLens[pattern] >= leftEnds[pair])
+            {
+                pView->pStart = pText + leftEnds[pair];
+                pView->length = end - pMatcher->patternLens[pattern] - leftEnds[pair];
+
+                return pair;
+            }
+        }
+    }
+
+    return -1;
+}
+
+void MatcherFree(Matcher *pMatcher)
+{
+    if (pMatcher)
+    {
+        for (int pattern=0; pattern<2 * pMatcher->pairs; pattern++)
+        {
+            free(pMatcher->pPatterns[pattern]);
+        }
+
+        free(pMatcher->pDelta);
+        free(pMatcher->pOutputs);
+        free(pMatcher);
+    }
+}
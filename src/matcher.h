@@ -0,0 +1,49 @@
+#ifndef MATCHER_H
+#define MATCHER_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define MATCHER_MAX_PAIRS    32
+#define MATCHER_MAX_PATTERNS (2 * MATCHER_MAX_PAIRS)
+
+// Aho-Corasick automaton over left/right marker pairs. One pass over the text
+// finds the first right marker that follows its own left marker, the text
+// between them is returned as a view into the source.
+
+typedef struct
+{
+    const char *pStart;
+    size_t     length;
+} MatchView;
+
+typedef struct
+{
+    char     *pPatterns[MATCHER_MAX_PATTERNS];
+    size_t   patternLens[MATCHER_MAX_PATTERNS];
+    int      pairs;
+
+    // Filled in by MatcherCompile, pDelta is states x 256 transitions and
+    // pOutputs the patterns ending in each state as a bitmask
+
+    int32_t  *pDelta;
+    uint64_t *pOutputs;
+    int      states;
+} Matcher;
+
+Matcher *MatcherNew(void);
+bool     MatcherAddPair(Matcher *pMatcher, const char *pLeft, const char *pRight);
+
+// "left|right" as given on the command line
+
+bool     MatcherAddSpec(Matcher *pMatcher, const char *pSpec);
+bool     MatcherCompile(Matcher *pMatcher);
+
+// Returns the index of the matching pair or -1. Safe to call from any thread
+// once compiled.
+
+int      MatcherFind(const Matcher *pMatcher, const char *pText, size_t textLen, MatchView *pView);
+void     MatcherFree(Matcher *pMatcher);
+
+#endif
@@ -0,0 +1,338 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <glib.h>
+#include <jansson.h>
+#include <curl/curl.h>
+
+#include "cantv.h"
+#include "metrics.h"
+
+#define METRIC_STATUS_CODES 600
+
+static const double s_bounds[] = { 0.0005, 0.001, 0.0025, 0.005, 0.01, 0.025, 0.05, 0.1, 0.25, 0.5, 1, 2.5, 5, 10 };
+
+#define METRIC_BUCKETS (sizeof(s_bounds) / sizeof(s_bounds[0]) + 1)
+
+static const char *s_pPhaseNames[METRIC_PHASES] = { "namelookup", "connect", "appconnect", "starttransfer", "total" };
+static const char *s_pStageNames[METRIC_STAGES] = { "list_page", "list_parse", "events_parse", "aggregate" };
+
+// buckets are not cumulative here, the last one is +Inf
+
+typedef struct
+{
+    long   buckets[METRIC_BUCKETS];
+    long   count;
+    double sum, max;
+} Histogram;
+
+typedef struct
+{
+    GMutex    lock;
+    double    started;
+    Histogram phases[METRIC_PHASES];
+    Histogram stages[METRIC_STAGES];
+    long      statusCounts[METRIC_STATUS_CODES];
+    long      requests;
+    curl_off_t bytesDown, bytesUp;
+} Metrics;
+
+static Metrics s_metrics;
+
+static void HistogramAdd(Histogram *pHistogram, double value)
+{
+    size_t bucket = 0;
+
+    while (bucket < METRIC_BUCKETS - 1 && value > s_bounds[bucket])
+    {
+        bucket++;
+    }
+
+    pHistogram->buckets[bucket]++;
+    pHistogram->count++;
+    pHistogram->sum += value;
+
+    if (value > pHistogram->max)
+    {
+        pHistogram->max = value;
+    }
+}
+
+// Upper bound of the bucket holding the quantile, the maximum for +Inf
+
+static double HistogramQuantile(const Histogram *pHistogram, double quantile)
+{
+    long target     = (long) (quantile * pHistogram->count + 0.5);
+    long cumulative = 0;
+
+    for (size_t bucket=0; bucket<METRIC_BUCKETS - 1; bucket++)
+    {
+        cumulative += pHistogram->buckets[bucket];
+
+        if (cumulative >= target && cumulative > 0)
+        {
+            return s_bounds[bucket] < pHistogram->max ? s_bounds[bucket] : pHistogram->max;
+        }
+    }
+
+    return pHistogram->max;
+}
+
+double MetricsNow(void)
+{
+    return g_get_monotonic_time() / 1e6;
+}
+
+void MetricsInit(void)
+{
+    g_mutex_init(&s_metrics.lock);
+
+    s_metrics.started = MetricsNow();
+}
+
+void MetricsRecordRequest(CURL *pCurl, int status)
+{
+    // curl reports each phase as the time from the start of the transfer
+
+    static const CURLINFO phaseInfo[METRIC_PHASES] = { CURLINFO_NAMELOOKUP_TIME_T, CURLINFO_CONNECT_TIME_T, CURLINFO_APPCONNECT_TIME_T,
+                                                       CURLINFO_STARTTRANSFER_TIME_T, CURLINFO_TOTAL_TIME_T };
+
+    curl_off_t phases[METRIC_PHASES];
+    curl_off_t bytesDown = 0, bytesUp = 0;
+
+    for (int phase=0; phase<METRIC_PHASES; phase++)
+    {
+        phases[phase] = 0;
+
+        curl_easy_getinfo(pCurl, phaseInfo[phase], &phases[phase]);
+    }
+
+    curl_easy_getinfo(pCurl, CURLINFO_SIZE_DOWNLOAD_T, &bytesDown);
+    curl_easy_getinfo(pCurl, CURLINFO_SIZE_UPLOAD_T,   &bytesUp);
+
+    g_mutex_lock(&s_metrics.lock);
+
+    for (int phase=0; phase<METRIC_PHASES; phase++)
+    {
+        HistogramAdd(&s_metrics.phases[phase], phases[phase] / 1e6);
+    }
+
+    s_metrics.statusCounts[status > 0 && status < METRIC_STATUS_CODES ? status : 0]++;
+    s_metrics.requests++;
+    s_metrics.bytesDown += bytesDown;
+    s_metrics.bytesUp   += bytesUp;
+
+    g_mutex_unlock(&s_metrics.lock);
+}
+
+void MetricsRecordStage(MetricStage stage, double seconds)
+{
+    g_mutex_lock(&s_metrics.lock);
+
+    HistogramAdd(&s_metrics.stages[stage], seconds);
+
+    g_mutex_unlock(&s_metrics.lock);
+}
+
+size_t MetricsRSS(void)
+{
+    FILE *pStatm = fopen("/proc/self/statm", "r");
+
+    if (!pStatm)
+    {
+        return 0;
+    }
+
+    unsigned long pages = 0, residentPages = 0;
+
+    if (fscanf(pStatm, "%lu %lu", &pages, &residentPages) != 2)
+    {
+        residentPages = 0;
+    }
+
+    fclose(pStatm);
+
+    return (size_t) residentPages * sysconf(_SC_PAGESIZE);
+}
+
+size_t MetricsPeakRSS(void)
+{
+    struct rusage usage;
+
+    if (getrusage(RUSAGE_SELF, &usage) != 0)
+    {
+        return 0;
+    }
+
+    // Linux reports kilobytes
+
+    return (size_t) usage.ru_maxrss * 1024;
+}
+
+static void WriteHistogram(FILE *pFile, const char *pName, const char *pLabel, const char *pValue, const Histogram *pHistogram)
+{
+    long cumulative = 0;
+
+    for (size_t bucket=0; bucket<METRIC_BUCKETS; bucket++)
+    {
+        cumulative += pHistogram->buckets[bucket];
+
+        if (bucket < METRIC_BUCKETS - 1)
+        {
+            fprintf(pFile, "%s_bucket{%s=\"%s\",le=\"%g\"} %ld\n", pName, pLabel, pValue, s_bounds[bucket], cumulative);
+        }
+        else
+        {
+            fprintf(pFile, "%s_bucket{%s=\"%s\",le=\"+Inf\"} %ld\n", pName, pLabel, pValue, cumulative);
+        }
+    }
+
+    fprintf(pFile, "%s_sum{%s=\"%s\"} %.6f\n",  pName, pLabel, pValue, pHistogram->sum);
+    fprintf(pFile, "%s_count{%s=\"%s\"} %ld\n", pName, pLabel, pValue, pHistogram->count);
+}
+
+// Written to a temporary file and renamed so a textfile collector never reads a partial file
+
+bool MetricsWritePrometheus(const char *pPath)
+{
+    char *pTempPath;
+
+    asprintf(&pTempPath, "%s.tmp", pPath);
+
+    FILE *pFile = fopen(pTempPath, "wb");
+
+    if (!pFile)
+    {
+        fprintf(stderr, "Failure writing metrics %s\n", pPath);
+
+        free(pTempPath);
+        return false;
+    }
+
+    g_mutex_lock(&s_metrics.lock);
+
+    fprintf(pFile, "# HELP cantv_http_phase_seconds Time from request start to the end of each curl phase\n");
+    fprintf(pFile, "# TYPE cantv_http_phase_seconds histogram\n");
+
+    for (int phase=0; phase<METRIC_PHASES; phase++)
+    {
+        WriteHistogram(pFile, "cantv_http_phase_seconds", "phase", s_pPhaseNames[phase], &s_metrics.phases[phase]);
+    }
+
+    fprintf(pFile, "# HELP cantv_stage_seconds Time spent listing, parsing and aggregating\n");
+    fprintf(pFile, "# TYPE cantv_stage_seconds histogram\n");
+
+    for (int stage=0; stage<METRIC_STAGES; stage++)
+    {
+        WriteHistogram(pFile, "cantv_stage_seconds", "stage", s_pStageNames[stage], &s_metrics.stages[stage]);
+    }
+
+    fprintf(pFile, "# HELP cantv_http_requests_total Completed HTTP requests by status, 0 for transport failures\n");
+    fprintf(pFile, "# TYPE cantv_http_requests_total counter\n");
+
+    for (int status=0; status<METRIC_STATUS_CODES; status++)
+    {
+        if (s_metrics.statusCounts[status])
+        {
+            fprintf(pFile, "cantv_http_requests_total{status=\"%d\"} %ld\n", status, s_metrics.statusCounts[status]);
+        }
+    }
+
+    fprintf(pFile, "# HELP cantv_http_bytes_total HTTP body bytes transferred\n");
+    fprintf(pFile, "# TYPE cantv_http_bytes_total counter\n");
+    fprintf(pFile, "cantv_http_bytes_total{direction=\"down\"} %lld\n", (long long) s_metrics.bytesDown);
+    fprintf(pFile, "cantv_http_bytes_total{direction=\"up\"} %lld\n",   (long long) s_metrics.bytesUp);
+
+    fprintf(pFile, "# HELP cantv_run_seconds Wall time of the run\n");
+    fprintf(pFile, "# TYPE cantv_run_seconds gauge\n");
+    fprintf(pFile, "cantv_run_seconds %.3f\n", MetricsNow() - s_metrics.started);
+
+    fprintf(pFile, "# HELP cantv_peak_rss_bytes Peak resident memory of the run\n");
+    fprintf(pFile, "# TYPE cantv_peak_rss_bytes gauge\n");
+    fprintf(pFile, "cantv_peak_rss_bytes %zu\n", MetricsPeakRSS());
+
+    g_mutex_unlock(&s_metrics.lock);
+
+    bool bWritten = fclose(pFile) == 0 && rename(pTempPath, pPath) == 0;
+
+    if (!bWritten)
+    {
+        fprintf(stderr, "Failure writing metrics %s\n", pPath);
+    }
+
+    free(pTempPath);
+
+    return bWritten;
+}
+
+static json_t *HistogramJSON(const Histogram *pHistogram)
+{
+    return json_pack("{s:I, s:f, s:f, s:f, s:f, s:f, s:f}",
+                     "count", (json_int_t) pHistogram->count,
+                     "sum",   pHistogram->sum,
+                     "mean",  pHistogram->count ? pHistogram->sum / pHistogram->count : 0.0,
+                     "p50",   HistogramQuantile(pHistogram, 0.50),
+                     "p90",   HistogramQuantile(pHistogram, 0.90),
+                     "p99",   HistogramQuantile(pHistogram, 0.99),
+                     "max",   pHistogram->max);
+}
+
+bool MetricsWriteJSON(const char *pPath)
+{
+    json_t *pSummary = json_object();
+    json_t *pPhases  = json_object();
+    json_t *pStages  = json_object();
+    json_t *pStatus  = json_object();
+
+    g_mutex_lock(&s_metrics.lock);
+
+    double elapsed = MetricsNow() - s_metrics.started;
+
+    for (int phase=0; phase<METRIC_PHASES; phase++)
+    {
+        json_object_set_new(pPhases, s_pPhaseNames[phase], HistogramJSON(&s_metrics.phases[phase]));
+    }
+
+    for (int stage=0; stage<METRIC_STAGES; stage++)
+    {
+        json_object_set_new(pStages, s_pStageNames[stage], HistogramJSON(&s_metrics.stages[stage]));
+    }
+
+    for (int status=0; status<METRIC_STATUS_CODES; status++)
+    {
+        if (s_metrics.statusCounts[status])
+        {
+            char code[8];
+
+            snprintf(code, sizeof(code), "%d", status);
+
+            json_object_set_new(pStatus, code, json_integer(s_metrics.statusCounts[status]));
+        }
+    }
+
+    json_object_set_new(pSummary, "run_seconds",      json_real(elapsed));
+    json_object_set_new(pSummary, "requests",         json_integer(s_metrics.requests));
+    json_object_set_new(pSummary, "requests_per_sec", json_real(elapsed > 0 ? s_metrics.requests / elapsed : 0));
+    json_object_set_new(pSummary, "bytes_down",       json_integer(s_metrics.bytesDown));
+    json_object_set_new(pSummary, "bytes_up",         json_integer(s_metrics.bytesUp));
+    json_object_set_new(pSummary, "peak_rss_bytes",   json_integer(MetricsPeakRSS()));
+
+    g_mutex_unlock(&s_metrics.lock);
+
+    json_object_set_new(pSummary, "status", pStatus);
+    json_object_set_new(pSummary, "phases", pPhases);
+    json_object_set_new(pSummary, "stages", pStages);
+
+    bool bWritten = json_dump_file(pSummary, pPath, JSON_INDENT(2) | JSON_REAL_PRECISION(6)) == 0;
+
+    if (!bWritten)
+    {
+        fprintf(stderr, "Failure writing metrics summary %s\n", pPath);
+    }
+
+    json_decref(pSummary);
+
+    return bWritten;
+}
@@ -0,0 +1,49 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <curl/curl.h>
+
+// Run wide latency histograms and counters, exported at exit as a Prometheus
+// textfile and a JSON summary. Safe to record from any thread.
+
+typedef enum
+{
+    METRIC_PHASE_NAMELOOKUP,
+    METRIC_PHASE_CONNECT,
+    METRIC_PHASE_APPCONNECT,
+    METRIC_PHASE_STARTTRANSFER,
+    METRIC_PHASE_TOTAL,
+    METRIC_PHASES
+} MetricPhase;
+
+typedef enum
+{
+    METRIC_STAGE_LIST_PAGE,
+    METRIC_STAGE_LIST_PARSE,
+    METRIC_STAGE_EVENTS_PARSE,
+    METRIC_STAGE_AGGREGATE,
+    METRIC_STAGES
+} MetricStage;
+
+void   MetricsInit(void);
+
+// Seconds on a monotonic clock, for timing stages
+
+double MetricsNow(void);
+
+// status 0 for transfers that failed before a response arrived
+
+void   MetricsRecordRequest(CURL *pCurl, int status);
+void   MetricsRecordStage(MetricStage stage, double seconds);
+
+// Resident memory of the process now and at its peak, in bytes
+
+size_t MetricsRSS(void);
+size_t MetricsPeakRSS(void);
+
+bool   MetricsWritePrometheus(const char *pPath);
+bool   MetricsWriteJSON(const char *pPath);
+
+#endif
@@ -0,0 +1,147 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "reportbuffer.h"
+
+// Two digits at a time, "00" to "99"
+
+static const char s_digitPairs[] = "00010203040506070809101112131415161718192021222324252627282930313233343536373839404142434445464748495051525354555657585960616263646566676869707172737475767778798081828384858687888990919293949596979899";
+
+void ReportBufferInit(ReportBuffer *pBuffer, size_t capacity)
+{
+    pBuffer->pData    = malloc(capacity > 0 ? capacity : 1);
+    pBuffer->length   = 0;
+    pBuffer->capacity = pBuffer->pData ? (capacity > 0 ? capacity : 1) : 0;
+    pBuffer->bFailed  = !pBuffer->pData;
+}
+
+void ReportBufferReset(ReportBuffer *pBuffer)
+{
+    pBuffer->length  = 0;
+    pBuffer->bFailed = !pBuffer->pData;
+}
+
+void ReportBufferFree(ReportBuffer *pBuffer)
+{
+    free(pBuffer->pData);
+
+    pBuffer->pData    = NULL;
+    pBuffer->length   = 0;
+    pBuffer->capacity = 0;
+}
+
+static bool Reserve(ReportBuffer *pBuffer, size_t extra)
+{
+    if (pBuffer->bFailed)
+    {
+        return false;
+    }
+
+    if (pBuffer->length + extra <= pBuffer->capacity)
+    {
+        return true;
+    }
+
+    size_t capacity = pBuffer->capacity > 0 ? pBuffer->capacity : 64;
+
+    while (capacity < pBuffer->length + extra)
+    {
+        capacity *= 2;
+    }
+
+    char *pData = realloc(pBuffer->pData, capacity);
+
+    if (!pData)
+    {
+        fprintf(stderr, "Failure growing a report to %zu bytes\n", capacity);
+
+        pBuffer->bFailed = true;
+        return false;
+    }
+
+    pBuffer->pData    = pData;
+    pBuffer->capacity = capacity;
+
+    return true;
+}
+
+void ReportBufferAppend(ReportBuffer *pBuffer, const char *pText, size_t textLen)
+{
+    if (Reserve(pBuffer, textLen))
+    {
+        memcpy(pBuffer->pData + pBuffer->length, pText, textLen);
+
+        pBuffer->length += textLen;
+    }
+}
+
+void ReportBufferAppendText(ReportBuffer *pBuffer, const char *pText)
+{
+    ReportBufferAppend(pBuffer, pText, strlen(pText));
+}
+
+// Formats from the last digit backwards, two digits per division
+
+void ReportBufferAppendInt(ReportBuffer *pBuffer, int value)
+{
+    char digits[12];
+    char *pEnd   = digits + sizeof(digits);
+    char *pStart = pEnd;
+
+    unsigned int magnitude = value < 0 ? 0u - (unsigned int) value : (unsigned int) value;
+
+    while (magnitude >= 100)
+    {
+        unsigned int pair = (magnitude % 100) * 2;
+
+        magnitude /= 100;
+
+        *--pStart = s_digitPairs[pair + 1];
+        *--pStart = s_digitPairs[pair];
+    }
+
+    if (magnitude >= 10)
+    {
+        *--pStart = s_digitPairs[magnitude * 2 + 1];
+        *--pStart = s_digitPairs[magnitude * 2];
+    }
+    else
+    {
+        *--pStart = '0' + magnitude;
+    }
+
+    if (value < 0)
+    {
+        *--pStart = '-';
+    }
+
+    ReportBufferAppend(pBuffer, pStart, pEnd - pStart);
+}
+
+char *ReportBufferCopy(const ReportBuffer *pBuffer)
+{
+    char *pCopy = malloc(pBuffer->length > 0 ? pBuffer->length : 1);
+
+    if (pCopy && pBuffer->length > 0)
+    {
+        memcpy(pCopy, pBuffer->pData, pBuffer->length);
+    }
+
+    return pCopy;
+}
+
+bool ReportBufferWriteFile(const ReportBuffer *pBuffer, const char *pPath)
+{
+    FILE *pFile = fopen(pPath, "wb");
+
+    if (!pFile)
+    {
+        fprintf(stderr, "Failure writing report %s\n", pPath);
+        return false;
+    }
+
+    bool bWritten = fwrite(pBuffer->pData, 1, pBuffer->length, pFile) == pBuffer->length;
+
+    return fclose(pFile) == 0 && bWritten;
+}
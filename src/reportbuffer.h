@@ -0,0 +1,32 @@
+#ifndef REPORTBUFFER_H
+#define REPORTBUFFER_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+// Growable text buffer a report is rendered into once, then handed as is to
+// the file writer, the email encoder and the service endpoint. An allocation
+// failure sets bFailed and drops everything appended after it.
+
+typedef struct
+{
+    char   *pData;
+    size_t length, capacity;
+    bool   bFailed;
+} ReportBuffer;
+
+void  ReportBufferInit(ReportBuffer *pBuffer, size_t capacity);
+void  ReportBufferReset(ReportBuffer *pBuffer);
+void  ReportBufferFree(ReportBuffer *pBuffer);
+
+void  ReportBufferAppend(ReportBuffer *pBuffer, const char *pText, size_t textLen);
+void  ReportBufferAppendText(ReportBuffer *pBuffer, const char *pText);
+void  ReportBufferAppendInt(ReportBuffer *pBuffer, int value);
+
+// A malloc'd copy of the contents, for owners like ServicePublish
+
+char *ReportBufferCopy(const ReportBuffer *pBuffer);
+
+bool  ReportBufferWriteFile(const ReportBuffer *pBuffer, const char *pPath);
+
+#endif
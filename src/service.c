@@ -0,0 +1,249 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <glib.h>
+
+#include "service.h"
+
+#define SERVICE_REQUEST_BYTES 4096
+#define SERVICE_POLL_MS       500
+
+typedef struct
+{
+    GMutex     lock;
+    GHashTable *pSnapshots;
+    int        listenSocket;
+    GThread    *pThread;
+    gint       stopping;
+} Service;
+
+static Service s_service = { .listenSocket = -1 };
+
+static const char *ContentType(const char *pName)
+{
+    if (g_str_has_suffix(pName, ".json"))
+    {
+        return "application/json";
+    }
+
+    if (g_str_has_suffix(pName, ".csv"))
+    {
+        return "text/csv; charset=utf-8";
+    }
+
+    return "text/plain; charset=utf-8";
+}
+
+static bool SendAll(int clientSocket, const char *pData, size_t dataLen)
+{
+    while (dataLen > 0)
+    {
+        ssize_t sent = send(clientSocket, pData, dataLen, MSG_NOSIGNAL);
+
+        if (sent <= 0)
+        {
+            return false;
+        }
+
+        pData   += sent;
+        dataLen -= sent;
+    }
+
+    return true;
+}
+
+static void SendResponse(int clientSocket, const char *pStatus, const char *pType, const char *pBody, size_t bodyLen, bool bHead)
+{
+    char headers[256];
+
+    int headersLen = snprintf(headers, sizeof(headers), "HTTP/1.1 %s\r\nContent-Type: %s\r\nContent-Length: %zu\r\nCache-Control: no-store\r\nConnection: close\r\n\r\n",
+                              pStatus, pType, bodyLen);
+
+    if (SendAll(clientSocket, headers, headersLen) && !bHead)
+    {
+        SendAll(clientSocket, pBody, bodyLen);
+    }
+}
+
+static void HandleRequest(int clientSocket)
+{
+    char request[SERVICE_REQUEST_BYTES];
+    int  requestLen = 0;
+
+    // Only the request line matters, the rest of the headers are ignored
+
+    while (requestLen < (int) sizeof(request) - 1 && !memchr(request, '\n', requestLen))
+    {
+        ssize_t received = recv(clientSocket, request + requestLen, sizeof(request) - 1 - requestLen, 0);
+
+        if (received <= 0)
+        {
+            return;
+        }
+
+        requestLen += received;
+    }
+
+    request[requestLen] = 0;
+
+    char method[8], path[256];
+
+    if (sscanf(request, "%7s %255s", method, path) != 2)
+    {
+        SendResponse(clientSocket, "400 Bad Request", "text/plain", "Bad Request\n", 12, false);
+        return;
+    }
+
+    bool bHead = strcmp(method, "HEAD") == 0;
+
+    if (!bHead && strcmp(method, "GET") != 0)
+    {
+        SendResponse(clientSocket, "405 Method Not Allowed", "text/plain", "Method Not Allowed\n", 19, false);
+        return;
+    }
+
+    path[strcspn(path, "?#")] = 0;
+
+    const char *pName = strcmp(path, "/") == 0 ? "report.csv" : path + 1;
+
+    g_mutex_lock(&s_service.lock);
+
+    GBytes *pSnapshot = g_hash_table_lookup(s_service.pSnapshots, pName);
+
+    if (pSnapshot)
+    {
+        g_bytes_ref(pSnapshot);
+    }
+
+    g_mutex_unlock(&s_service.lock);
+
+    if (!pSnapshot)
+    {
+        SendResponse(clientSocket, "404 Not Found", "text/plain", "Not Found\n", 10, bHead);
+        return;
+    }
+
+    gsize snapshotLen;
+
+    const char *pData = g_bytes_get_data(pSnapshot, &snapshotLen);
+
+    SendResponse(clientSocket, "200 OK", ContentType(pName), pData, snapshotLen, bHead);
+
+    g_bytes_unref(pSnapshot);
+}
+
+// Requests are answered one at a time, each is a copy of a ready snapshot
+
+static gpointer ServiceThread(gpointer pData)
+{
+    while (!g_atomic_int_get(&s_service.stopping))
+    {
+        struct pollfd listenPoll = { s_service.listenSocket, POLLIN, 0 };
+
+        if (poll(&listenPoll, 1, SERVICE_POLL_MS) <= 0)
+        {
+            continue;
+        }
+
+        int clientSocket = accept(s_service.listenSocket, NULL, NULL);
+
+        if (clientSocket < 0)
+        {
+            continue;
+        }
+
+        struct timeval timeout = { 2, 0 };
+
+        setsockopt(clientSocket, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+        setsockopt(clientSocket, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+        HandleRequest(clientSocket);
+
+        close(clientSocket);
+    }
+
+    return NULL;
+}
+
+// Bound to the loopback interface only, the reports aren't meant to leave the host
+
+bool ServiceStart(int port)
+{
+    g_mutex_init(&s_service.lock);
+
+    s_service.pSnapshots = g_hash_table_new_full(g_str_hash, g_str_equal, free, (GDestroyNotify) g_bytes_unref);
+
+    s_service.listenSocket = socket(AF_INET, SOCK_STREAM, 0);
+
+    int reuse = 1;
+
+    setsockopt(s_service.listenSocket, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+
+    struct sockaddr_in address;
+
+    memset(&address, 0, sizeof(address));
+
+    address.sin_family      = AF_INET;
+    address.sin_port        = htons(port);
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    if (s_service.listenSocket < 0 || bind(s_service.listenSocket, (struct sockaddr *) &address, sizeof(address)) != 0 || listen(s_service.listenSocket, 16) != 0)
+    {
+        fprintf(stderr, "Failure listening on 127.0.0.1:%d\n", port);
+
+        if (s_service.listenSocket >= 0)
+        {
+            close(s_service.listenSocket);
+        }
+
+        s_service.listenSocket = -1;
+        return false;
+    }
+
+    s_service.pThread = g_thread_new("service", ServiceThread, NULL);
+
+    fprintf(stderr, "Serving    : http://127.0.0.1:%d/\n", port);
+
+    return true;
+}
+
+void ServicePublish(const char *pName, char *pData, size_t dataLen)
+{
+    if (s_service.listenSocket < 0)
+    {
+        free(pData);
+        return;
+    }
+
+    GBytes *pSnapshot = g_bytes_new_take(pData, dataLen);
+
+    g_mutex_lock(&s_service.lock);
+
+    g_hash_table_replace(s_service.pSnapshots, strdup(pName), pSnapshot);
+
+    g_mutex_unlock(&s_service.lock);
+}
+
+void ServiceStop(void)
+{
+    if (s_service.listenSocket < 0)
+    {
+        return;
+    }
+
+    g_atomic_int_set(&s_service.stopping, 1);
+
+    g_thread_join(s_service.pThread);
+
+    close(s_service.listenSocket);
+
+    s_service.listenSocket = -1;
+
+    g_hash_table_destroy(s_service.pSnapshots);
+}
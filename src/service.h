@@ -0,0 +1,20 @@
+#ifndef SERVICE_H
+#define SERVICE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+// Local HTTP endpoint for service mode. Reports are rendered by the polling
+// loop and published here as immutable snapshots, so a request never waits on
+// aggregation: GET /<name> returns the latest snapshot published under name,
+// GET / returns report.csv.
+
+bool ServiceStart(int port);
+
+// Takes ownership of pData, which must come from malloc. Dropped once the
+// service has stopped.
+
+void ServicePublish(const char *pName, char *pData, size_t dataLen);
+void ServiceStop(void);
+
+#endif
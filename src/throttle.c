@@ -0,0 +1,216 @@
+#include <stdio.h>
+#include <glib.h>
+#include <curl/curl.h>
+
+#include "throttle.h"
+
+#define THROTTLE_DEFAULT_PAUSE_US 1000000
+#define THROTTLE_DECREASE_GAP_US  1000000
+
+typedef struct
+{
+    GMutex lock;
+    double rate, tokens, burst;
+    double limit;
+    int    maxLimit;
+    gint64 lastRefill, pausedUntil, lastDecrease, started;
+    long   completed, throttled, failed;
+} Throttle;
+
+static Throttle s_throttle;
+
+void ThrottleInit(double rate, int maxLimit)
+{
+    g_mutex_init(&s_throttle.lock);
+
+    s_throttle.maxLimit   = maxLimit > 0 ? maxLimit : 1;
+    s_throttle.limit      = s_throttle.maxLimit;
+    s_throttle.rate       = rate > 0 ? rate : 0;
+    s_throttle.burst      = s_throttle.maxLimit;
+    s_throttle.tokens     = s_throttle.burst;
+    s_throttle.started    = g_get_monotonic_time();
+    s_throttle.lastRefill = s_throttle.started;
+}
+
+// Caller holds the lock
+
+static void Refill(gint64 now)
+{
+    if (s_throttle.rate > 0)
+    {
+        s_throttle.tokens += (now - s_throttle.lastRefill) * s_throttle.rate / 1e6;
+
+        if (s_throttle.tokens > s_throttle.burst)
+        {
+            s_throttle.tokens = s_throttle.burst;
+        }
+    }
+
+    s_throttle.lastRefill = now;
+}
+
+static gint64 DelayUs(gint64 now)
+{
+    gint64 delay = s_throttle.pausedUntil > now ? s_throttle.pausedUntil - now : 0;
+
+    if (s_throttle.rate > 0 && s_throttle.tokens < 1)
+    {
+        gint64 refill = (gint64) ((1 - s_throttle.tokens) * 1e6 / s_throttle.rate) + 1;
+
+        if (refill > delay)
+        {
+            delay = refill;
+        }
+    }
+
+    return delay;
+}
+
+static bool TakeToken(gint64 now)
+{
+    Refill(now);
+
+    if (DelayUs(now) > 0)
+    {
+        return false;
+    }
+
+    if (s_throttle.rate > 0)
+    {
+        s_throttle.tokens -= 1;
+    }
+
+    return true;
+}
+
+bool ThrottleTryAcquire(int inFlight)
+{
+    g_mutex_lock(&s_throttle.lock);
+
+    bool bAcquired = inFlight < (int) s_throttle.limit && TakeToken(g_get_monotonic_time());
+
+    g_mutex_unlock(&s_throttle.lock);
+
+    return bAcquired;
+}
+
+int ThrottleDelayMs(void)
+{
+    g_mutex_lock(&s_throttle.lock);
+
+    gint64 now = g_get_monotonic_time();
+
+    Refill(now);
+
+    int delayMs = (int) ((DelayUs(now) + 999) / 1000);
+
+    g_mutex_unlock(&s_throttle.lock);
+
+    return delayMs;
+}
+
+void ThrottleWait(void)
+{
+    while (1)
+    {
+        g_mutex_lock(&s_throttle.lock);
+
+        gint64 now = g_get_monotonic_time();
+
+        bool   bAcquired = TakeToken(now);
+        gint64 delay     = DelayUs(now);
+
+        g_mutex_unlock(&s_throttle.lock);
+
+        if (bAcquired)
+        {
+            return;
+        }
+
+        g_usleep(delay > 0 ? delay : 1000);
+    }
+}
+
+bool ThrottleComplete(CURL *pCurl, int status)
+{
+    bool bThrottled = status == 429 || status == 503;
+
+    gint64 pause = THROTTLE_DEFAULT_PAUSE_US;
+
+    if (bThrottled && pCurl)
+    {
+        curl_off_t retryAfter = 0;
+
+        if (curl_easy_getinfo(pCurl, CURLINFO_RETRY_AFTER, &retryAfter) == CURLE_OK && retryAfter > 0)
+        {
+            pause = (gint64) retryAfter * 1000000;
+        }
+    }
+
+    g_mutex_lock(&s_throttle.lock);
+
+    gint64 now = g_get_monotonic_time();
+
+    if (bThrottled)
+    {
+        s_throttle.throttled++;
+
+        if (now + pause > s_throttle.pausedUntil)
+        {
+            s_throttle.pausedUntil = now + pause;
+        }
+
+        // One decrease per burst of rejections, they all report the same overload
+
+        if (now - s_throttle.lastDecrease >= THROTTLE_DECREASE_GAP_US)
+        {
+            s_throttle.limit = s_throttle.limit / 2 > 1 ? s_throttle.limit / 2 : 1;
+
+            s_throttle.lastDecrease = now;
+        }
+    }
+    else
+    {
+        s_throttle.completed++;
+
+        if (status != 200)
+        {
+            s_throttle.failed++;
+        }
+
+        s_throttle.limit += 1 / s_throttle.limit;
+
+        if (s_throttle.limit > s_throttle.maxLimit)
+        {
+            s_throttle.limit = s_throttle.maxLimit;
+        }
+    }
+
+    g_mutex_unlock(&s_throttle.lock);
+
+    return bThrottled;
+}
+
+ThrottleStats ThrottleGetStats(void)
+{
+    g_mutex_lock(&s_throttle.lock);
+
+    double elapsed = (g_get_monotonic_time() - s_throttle.started) / 1e6;
+
+    ThrottleStats stats = { s_throttle.completed, s_throttle.throttled, s_throttle.failed, s_throttle.limit,
+                            elapsed > 0 ? s_throttle.completed / elapsed : 0 };
+
+    g_mutex_unlock(&s_throttle.lock);
+
+    return stats;
+}
+
+void ThrottleShowStats(void)
+{
+    ThrottleStats stats = ThrottleGetStats();
+
+    fprintf(stderr, "Req/Sec    : %.1f\n", stats.requestsPerSec);
+    fprintf(stderr, "Throttled  : %ld\n", stats.throttled);
+    fprintf(stderr, "Failed     : %ld\n", stats.failed);
+    fprintf(stderr, "Limit      : %.1f\n", stats.limit);
+}
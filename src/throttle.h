@@ -0,0 +1,42 @@
+#ifndef THROTTLE_H
+#define THROTTLE_H
+
+#include <stdbool.h>
+#include <curl/curl.h>
+
+#define THROTTLE_MAX_ATTEMPTS 10
+
+// Process wide request scheduler shared by the listing and Events.json paths.
+// A token bucket caps the request rate (0 for no cap) and an AIMD limit tracks
+// how many requests may be in flight: +1/limit per success, halved at most once
+// a second on 429/503, which also pause every sender for the Retry-After time.
+
+typedef struct
+{
+    long   completed, throttled, failed;
+    double limit, requestsPerSec;
+} ThrottleStats;
+
+void ThrottleInit(double rate, int maxLimit);
+
+// Non-blocking, consumes a token when a request may start with inFlight running
+
+bool ThrottleTryAcquire(int inFlight);
+
+// Milliseconds until ThrottleTryAcquire could next succeed on rate or pause grounds
+
+int  ThrottleDelayMs(void);
+
+// Blocking acquire for synchronous requests, ignores the concurrency limit
+
+void ThrottleWait(void);
+
+// Records the outcome of a finished request, true if it was throttled and
+// should be sent again
+
+bool ThrottleComplete(CURL *pCurl, int status);
+
+ThrottleStats ThrottleGetStats(void);
+void          ThrottleShowStats(void);
+
+#endif
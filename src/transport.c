@@ -0,0 +1,175 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <glib.h>
+#include <curl/curl.h>
+
+#include "transport.h"
+
+#define TRANSPORT_POOL_SIZE 64
+
+typedef struct
+{
+    CURLSH         *pShare;
+    GMutex         shareLocks[CURL_LOCK_DATA_LAST];
+    GMutex         poolLock;
+    CURL           *pPool[TRANSPORT_POOL_SIZE];
+    int            poolCount;
+    TransportStats stats;
+} Transport;
+
+static Transport s_transport;
+
+static void ShareLock(CURL *pCurl, curl_lock_data data, curl_lock_access access, void *pUserPtr)
+{
+    g_mutex_lock(&s_transport.shareLocks[data]);
+}
+
+static void ShareUnlock(CURL *pCurl, curl_lock_data data, void *pUserPtr)
+{
+    g_mutex_unlock(&s_transport.shareLocks[data]);
+}
+
+bool TransportInit(void)
+{
+    for (int index=0; index<CURL_LOCK_DATA_LAST; index++)
+    {
+        g_mutex_init(&s_transport.shareLocks[index]);
+    }
+
+    g_mutex_init(&s_transport.poolLock);
+
+    s_transport.pShare = curl_share_init();
+
+    if (!s_transport.pShare)
+    {
+        fprintf(stderr, "Failure creating curl share\n");
+        return false;
+    }
+
+    curl_share_setopt(s_transport.pShare, CURLSHOPT_LOCKFUNC,   ShareLock);
+    curl_share_setopt(s_transport.pShare, CURLSHOPT_UNLOCKFUNC, ShareUnlock);
+    curl_share_setopt(s_transport.pShare, CURLSHOPT_SHARE,      CURL_LOCK_DATA_DNS);
+    curl_share_setopt(s_transport.pShare, CURLSHOPT_SHARE,      CURL_LOCK_DATA_SSL_SESSION);
+    curl_share_setopt(s_transport.pShare, CURLSHOPT_SHARE,      CURL_LOCK_DATA_CONNECT);
+
+    return true;
+}
+
+void TransportCleanup(void)
+{
+    for (int index=0; index<s_transport.poolCount; index++)
+    {
+        curl_easy_cleanup(s_transport.pPool[index]);
+    }
+
+    s_transport.poolCount = 0;
+
+    if (s_transport.pShare)
+    {
+        curl_share_cleanup(s_transport.pShare);
+        s_transport.pShare = NULL;
+    }
+}
+
+CURL *TransportAcquire(void)
+{
+    CURL *pCurl = NULL;
+
+    g_mutex_lock(&s_transport.poolLock);
+
+    if (s_transport.poolCount > 0)
+    {
+        pCurl = s_transport.pPool[--s_transport.poolCount];
+    }
+
+    g_mutex_unlock(&s_transport.poolLock);
+
+    if (!pCurl)
+    {
+        pCurl = curl_easy_init();
+
+        if (!pCurl)
+        {
+            return NULL;
+        }
+    }
+
+    if (s_transport.pShare)
+    {
+        curl_easy_setopt(pCurl, CURLOPT_SHARE, s_transport.pShare);
+    }
+
+    curl_easy_setopt(pCurl, CURLOPT_TCP_KEEPALIVE, 1L);
+    curl_easy_setopt(pCurl, CURLOPT_TCP_KEEPIDLE,  60L);
+    curl_easy_setopt(pCurl, CURLOPT_TCP_KEEPINTVL, 30L);
+    curl_easy_setopt(pCurl, CURLOPT_DNS_CACHE_TIMEOUT, -1L);
+
+    return pCurl;
+}
+
+void TransportRelease(CURL *pCurl)
+{
+    if (!pCurl)
+    {
+        return;
+    }
+
+    curl_easy_reset(pCurl);
+
+    g_mutex_lock(&s_transport.poolLock);
+
+    if (s_transport.poolCount < TRANSPORT_POOL_SIZE)
+    {
+        s_transport.pPool[s_transport.poolCount++] = pCurl;
+        pCurl = NULL;
+    }
+
+    g_mutex_unlock(&s_transport.poolLock);
+
+    if (pCurl)
+    {
+        curl_easy_cleanup(pCurl);
+    }
+}
+
+void TransportCount(CURL *pCurl)
+{
+    long newConnects = 0;
+
+    curl_easy_getinfo(pCurl, CURLINFO_NUM_CONNECTS, &newConnects);
+
+    g_mutex_lock(&s_transport.poolLock);
+
+    s_transport.stats.requests++;
+
+    if (newConnects > 0)
+    {
+        s_transport.stats.connectionsOpened += newConnects;
+    }
+    else
+    {
+        s_transport.stats.connectionsReused++;
+    }
+
+    g_mutex_unlock(&s_transport.poolLock);
+}
+
+TransportStats TransportGetStats(void)
+{
+    g_mutex_lock(&s_transport.poolLock);
+
+    TransportStats stats = s_transport.stats;
+
+    g_mutex_unlock(&s_transport.poolLock);
+
+    return stats;
+}
+
+void TransportShowStats(void)
+{
+    TransportStats stats = TransportGetStats();
+
+    fprintf(stderr, "Requests   : %ld\n", stats.requests);
+    fprintf(stderr, "Conn Opened: %ld\n", stats.connectionsOpened);
+    fprintf(stderr, "Conn Reused: %ld\n", stats.connectionsReused);
+}
@@ -0,0 +1,27 @@
+#ifndef TRANSPORT_H
+#define TRANSPORT_H
+
+#include <stdbool.h>
+#include <curl/curl.h>
+
+typedef struct
+{
+    long requests, connectionsOpened, connectionsReused;
+} TransportStats;
+
+bool TransportInit(void);
+void TransportCleanup(void);
+
+// Handles come from a pool and share DNS, connection and TLS session caches for the whole run
+
+CURL *TransportAcquire(void);
+void  TransportRelease(CURL *pCurl);
+
+// Call once per completed transfer to update the reuse counters
+
+void TransportCount(CURL *pCurl);
+
+TransportStats TransportGetStats(void);
+void           TransportShowStats(void);
+
+#endif
@@ -0,0 +1,259 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <glib.h>
+
+#include "workpool.h"
+
+// Sleeping follows the same order on both sides: announce the sleep, then
+// look at the ring again. The waker publishes to the ring, then looks at the
+// announcement, so one of the two always sees the other.
+
+static gpointer WorkerThread(gpointer pData)
+{
+    Worker   *pWorker = (Worker *) pData;
+    WorkPool *pPool   = pWorker->pPool;
+
+    while (1)
+    {
+        if (pWorker->workHead == (guint) g_atomic_int_get(&pWorker->workTail))
+        {
+            g_mutex_lock(&pWorker->lock);
+
+            g_atomic_int_set(&pWorker->bSleeping, 1);
+
+            while (pWorker->workHead == (guint) g_atomic_int_get(&pWorker->workTail) && !g_atomic_int_get(&pPool->bClosed))
+            {
+                g_cond_wait(&pWorker->wake, &pWorker->lock);
+            }
+
+            g_atomic_int_set(&pWorker->bSleeping, 0);
+
+            g_mutex_unlock(&pWorker->lock);
+
+            if (pWorker->workHead == (guint) g_atomic_int_get(&pWorker->workTail))
+            {
+                break;
+            }
+        }
+
+        void *pItem = pWorker->ppWork[pWorker->workHead++ & pPool->mask];
+
+        pPool->pWork(pItem, pWorker->index, pPool->pUserData);
+
+        // The producer never has more than depth items out with one worker so
+        // the done ring can't overflow
+
+        guint doneTail = (guint) g_atomic_int_get(&pWorker->doneTail);
+
+        pWorker->ppDone[doneTail & pPool->mask] = pItem;
+
+        g_atomic_int_set(&pWorker->doneTail, (gint) (doneTail + 1));
+
+        if (g_atomic_int_get(&pPool->bWaiting))
+        {
+            g_mutex_lock(&pPool->lock);
+            g_cond_signal(&pPool->done);
+            g_mutex_unlock(&pPool->lock);
+        }
+    }
+
+    return NULL;
+}
+
+WorkPool *WorkPoolNew(int workers, int depth, WorkFunc pWork, WorkFunc pDone, void *pUserData)
+{
+    WorkPool *pPool = calloc(1, sizeof(WorkPool));
+
+    guint capacity = 1;
+
+    while (capacity < (guint) depth)
+    {
+        capacity <<= 1;
+    }
+
+    pPool->pWorkers  = calloc(workers, sizeof(Worker));
+    pPool->workers   = workers;
+    pPool->mask      = capacity - 1;
+    pPool->pWork     = pWork;
+    pPool->pDone     = pDone;
+    pPool->pUserData = pUserData;
+
+    g_mutex_init(&pPool->lock);
+    g_cond_init(&pPool->done);
+
+    for (int worker=0; worker<workers; worker++)
+    {
+        Worker *pWorker = &pPool->pWorkers[worker];
+
+        pWorker->pPool  = pPool;
+        pWorker->index  = worker;
+        pWorker->ppWork = calloc(capacity, sizeof(void *));
+        pWorker->ppDone = calloc(capacity, sizeof(void *));
+
+        g_mutex_init(&pWorker->lock);
+        g_cond_init(&pWorker->wake);
+
+        pWorker->pThread = g_thread_new("parse", WorkerThread, pWorker);
+    }
+
+    return pPool;
+}
+
+static bool CollectWorker(WorkPool *pPool, Worker *pWorker)
+{
+    guint doneTail = (guint) g_atomic_int_get(&pWorker->doneTail);
+
+    if (pWorker->doneHead == doneTail)
+    {
+        return false;
+    }
+
+    while (pWorker->doneHead != doneTail)
+    {
+        void *pItem = pWorker->ppDone[pWorker->doneHead++ & pPool->mask];
+
+        pWorker->pending--;
+
+        pPool->pDone(pItem, pWorker->index, pPool->pUserData);
+    }
+
+    return true;
+}
+
+void WorkPoolCollect(WorkPool *pPool)
+{
+    for (int worker=0; worker<pPool->workers; worker++)
+    {
+        CollectWorker(pPool, &pPool->pWorkers[worker]);
+    }
+}
+
+static bool AnyDone(WorkPool *pPool)
+{
+    for (int worker=0; worker<pPool->workers; worker++)
+    {
+        Worker *pWorker = &pPool->pWorkers[worker];
+
+        if (pWorker->doneHead != (guint) g_atomic_int_get(&pWorker->doneTail))
+        {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+// Sleeps until some worker has finished an item
+
+static void WaitForDone(WorkPool *pPool)
+{
+    g_mutex_lock(&pPool->lock);
+
+    g_atomic_int_set(&pPool->bWaiting, 1);
+
+    while (!AnyDone(pPool))
+    {
+        g_cond_wait(&pPool->done, &pPool->lock);
+    }
+
+    g_atomic_int_set(&pPool->bWaiting, 0);
+
+    g_mutex_unlock(&pPool->lock);
+}
+
+void WorkPoolSubmit(WorkPool *pPool, void *pItem)
+{
+    WorkPoolCollect(pPool);
+
+    while (1)
+    {
+        for (int tries=0; tries<pPool->workers; tries++)
+        {
+            Worker *pWorker = &pPool->pWorkers[pPool->next];
+
+            pPool->next = (pPool->next + 1) % pPool->workers;
+
+            if (pWorker->pending > (int) pPool->mask)
+            {
+                continue;
+            }
+
+            guint workTail = (guint) g_atomic_int_get(&pWorker->workTail);
+
+            pWorker->ppWork[workTail & pPool->mask] = pItem;
+            pWorker->pending++;
+
+            g_atomic_int_set(&pWorker->workTail, (gint) (workTail + 1));
+
+            if (g_atomic_int_get(&pWorker->bSleeping))
+            {
+                g_mutex_lock(&pWorker->lock);
+                g_cond_signal(&pWorker->wake);
+                g_mutex_unlock(&pWorker->lock);
+            }
+
+            return;
+        }
+
+        WaitForDone(pPool);
+        WorkPoolCollect(pPool);
+    }
+}
+
+void WorkPoolDrain(WorkPool *pPool)
+{
+    while (1)
+    {
+        WorkPoolCollect(pPool);
+
+        bool bPending = false;
+
+        for (int worker=0; worker<pPool->workers; worker++)
+        {
+            bPending = bPending || pPool->pWorkers[worker].pending > 0;
+        }
+
+        if (!bPending)
+        {
+            break;
+        }
+
+        WaitForDone(pPool);
+    }
+}
+
+void WorkPoolFree(WorkPool *pPool)
+{
+    if (!pPool)
+    {
+        return;
+    }
+
+    WorkPoolDrain(pPool);
+
+    g_atomic_int_set(&pPool->bClosed, 1);
+
+    for (int worker=0; worker<pPool->workers; worker++)
+    {
+        Worker *pWorker = &pPool->pWorkers[worker];
+
+        g_mutex_lock(&pWorker->lock);
+        g_cond_signal(&pWorker->wake);
+        g_mutex_unlock(&pWorker->lock);
+
+        g_thread_join(pWorker->pThread);
+
+        g_cond_clear(&pWorker->wake);
+        g_mutex_clear(&pWorker->lock);
+
+        free(pWorker->ppWork);
+        free(pWorker->ppDone);
+    }
+
+    g_cond_clear(&pPool->done);
+    g_mutex_clear(&pPool->lock);
+
+    free(pPool->pWorkers);
+    free(pPool);
+}
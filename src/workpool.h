@@ -0,0 +1,67 @@
+#ifndef WORKPOOL_H
+#define WORKPOOL_H
+
+#include <stdbool.h>
+#include <glib.h>
+
+// Worker threads fed from a single producer thread. Every worker owns a pair
+// of single producer single consumer rings, one carrying work out and one
+// carrying finished items back, so handing an item over is an atomic store on
+// each side. Locks are only taken by a side about to sleep for lack of work.
+
+// pWork runs on worker number worker, pDone later on the producer thread
+
+typedef void (*WorkFunc)(void *pItem, int worker, void *pUserData);
+
+struct WorkPool;
+
+typedef struct
+{
+    struct WorkPool *pPool;
+    int             index;
+    GThread         *pThread;
+
+    void            **ppWork, **ppDone;
+    gint            workTail, doneTail;
+    guint           workHead, doneHead;
+    int             pending;
+
+    gint            bSleeping;
+    GMutex          lock;
+    GCond           wake;
+} Worker;
+
+typedef struct WorkPool
+{
+    Worker   *pWorkers;
+    int      workers, next;
+    guint    mask;
+    WorkFunc pWork, pDone;
+    void     *pUserData;
+
+    gint     bClosed, bWaiting;
+    GMutex   lock;
+    GCond    done;
+} WorkPool;
+
+// depth is the most items one worker holds at once, rounded up to a power of two
+
+WorkPool *WorkPoolNew(int workers, int depth, WorkFunc pWork, WorkFunc pDone, void *pUserData);
+
+// Runs pDone for finished items first, blocks while every worker is full
+
+void WorkPoolSubmit(WorkPool *pPool, void *pItem);
+
+// Runs pDone for every finished item without blocking
+
+void WorkPoolCollect(WorkPool *pPool);
+
+// Returns once every item submitted has finished and been collected
+
+void WorkPoolDrain(WorkPool *pPool);
+
+// Drains, then stops and joins the workers
+
+void WorkPoolFree(WorkPool *pPool);
+
+#endif